@@ -0,0 +1,195 @@
+#include "AutoExposure.h"
+#include "Camera.h"
+
+namespace ofxLibdc {
+
+static float dbToLinear(float db) {
+	return powf(10, db / 20);
+}
+
+static float linearToDb(float linear) {
+	return 20 * log10f(linear);
+}
+
+AutoExposure::AutoExposure() :
+target(110),
+maxClipped(0.01),
+response(0.5),
+deadband(0.05),
+minShutter(0),
+maxShutter(0),
+minGain(0),
+maxGain(0),
+shutter(0),
+gain(0),
+updated(false),
+running(false),
+pending(false) {
+}
+
+AutoExposure::~AutoExposure() {
+	stop();
+}
+
+void AutoExposure::setTarget(float target) {
+	lock_guard<mutex> guard(lock);
+	this->target = target;
+}
+
+void AutoExposure::setMaxClipped(float maxClipped) {
+	lock_guard<mutex> guard(lock);
+	this->maxClipped = maxClipped;
+}
+
+void AutoExposure::setResponse(float response) {
+	lock_guard<mutex> guard(lock);
+	this->response = response;
+}
+
+void AutoExposure::setDeadband(float deadband) {
+	lock_guard<mutex> guard(lock);
+	this->deadband = deadband;
+}
+
+void AutoExposure::setShutterRange(float minShutter, float maxShutter) {
+	lock_guard<mutex> guard(lock);
+	this->minShutter = minShutter;
+	this->maxShutter = maxShutter;
+}
+
+void AutoExposure::setGainRange(float minGain, float maxGain) {
+	lock_guard<mutex> guard(lock);
+	this->minGain = minGain;
+	this->maxGain = maxGain;
+}
+
+float AutoExposure::getShutter() const {
+	lock_guard<mutex> guard(lock);
+	return shutter;
+}
+
+float AutoExposure::getGain() const {
+	lock_guard<mutex> guard(lock);
+	return gain;
+}
+
+FrameStatistics AutoExposure::getStatistics() const {
+	lock_guard<mutex> guard(lock);
+	return current;
+}
+
+bool AutoExposure::start(Camera& camera) {
+	stop();
+
+	// ranges that weren't set by the user come from the camera
+	float cameraMin, cameraMax;
+	camera.getShutterAbsRange(&cameraMin, &cameraMax);
+	if(maxShutter <= minShutter) {
+		minShutter = cameraMin;
+		maxShutter = cameraMax;
+	}
+	if(maxShutter <= 0 || maxShutter <= minShutter) {
+		ofLogError() << "Auto exposure needs an absolute shutter range, the camera reports " <<
+			minShutter << " to " << maxShutter << " s.";
+		return false;
+	}
+	camera.getGainAbsRange(&cameraMin, &cameraMax);
+	if(maxGain <= minGain) {
+		minGain = cameraMin;
+		maxGain = cameraMax;
+	}
+
+	// switch both features to manual absolute control once, so every later
+	// update is a single register write
+	shutter = ofClamp(camera.getShutterAbs(), minShutter, maxShutter);
+	// a zero shutter can't be scaled, so start from the shortest one that isn't
+	if(shutter <= 0) {
+		shutter = minShutter > 0 ? minShutter : maxShutter;
+	}
+	gain = ofClamp(camera.getGainAbs(), minGain, maxGain);
+	camera.setShutterAbs(shutter);
+	camera.setGainAbs(gain);
+	ofLogVerbose() << "Starting auto exposure at " << shutter << " s and gain " << gain;
+
+	updated = false;
+	pending = false;
+	running = true;
+	controller = thread(&AutoExposure::controlThread, this);
+	return true;
+}
+
+void AutoExposure::stop() {
+	{
+		lock_guard<mutex> guard(lock);
+		if(!running)
+			return;
+		running = false;
+	}
+	statisticsAvailable.notify_all();
+	controller.join();
+}
+
+void AutoExposure::addStatistics(const FrameStatistics& statistics) {
+	{
+		lock_guard<mutex> guard(lock);
+		latest = statistics;
+		pending = true;
+	}
+	statisticsAvailable.notify_one();
+}
+
+bool AutoExposure::getUpdate(float& shutter, float& gain) {
+	lock_guard<mutex> guard(lock);
+	if(!updated)
+		return false;
+	shutter = this->shutter;
+	gain = this->gain;
+	updated = false;
+	return true;
+}
+
+void AutoExposure::controlThread() {
+	FrameStatistics statistics;
+	while(true) {
+		{
+			unique_lock<mutex> guard(lock);
+			while(!pending && running)
+				statisticsAvailable.wait(guard);
+			if(!running)
+				return;
+			statistics = latest;
+			pending = false;
+		}
+		update(statistics);
+	}
+}
+
+void AutoExposure::update(const FrameStatistics& statistics) {
+	lock_guard<mutex> guard(lock);
+	current = statistics;
+	const ChannelStatistics& luminance = statistics.luminance;
+	if(luminance.count == 0)
+		return;
+
+	float ratio = target / max(luminance.mean, 1.f);
+	float clipped = (float) luminance.clippedHigh / luminance.count;
+	if(clipped > maxClipped) {
+		ratio = min(ratio, 1 - min(clipped, .5f));
+	}
+	if(fabsf(ratio - 1) < deadband)
+		return;
+
+	// total exposure goes to the shutter first, and gain only makes up the rest
+	float exposure = shutter * dbToLinear(gain) * powf(ratio, response);
+	float nextShutter = ofClamp(exposure, minShutter, maxShutter);
+	if(nextShutter <= 0)
+		return;
+	float nextGain = ofClamp(linearToDb(exposure / nextShutter), minGain, maxGain);
+	if(nextShutter != shutter || nextGain != gain) {
+		shutter = nextShutter;
+		gain = nextGain;
+		updated = true;
+	}
+}
+
+}
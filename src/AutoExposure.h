@@ -0,0 +1,76 @@
+/*
+ ofxLibdc::AutoExposure is a software auto-exposure and auto-gain loop. It's
+ useful when the camera's built in auto modes are too slow or unpredictable.
+
+	ofxLibdc::Camera camera;
+	ofxLibdc::AutoExposure autoExposure;
+	camera.setup();
+	autoExposure.setTarget(100);
+	camera.setAutoExposure(&autoExposure);
+
+ The controller uses the luminance statistics the camera gathers while it
+ converts each frame (see Statistics.h), so there is no second pass over
+ the pixels. The control law runs on its own
+ thread, and the camera writes the resulting shutter and gain right after it
+ hands a frame back to the DMA ring, so settings only change between frames.
+
+ The loop works on total exposure (shutter times linear gain) in the log
+ domain. Shutter is raised first, up to its maximum, before gain is added,
+ which keeps noise down. If more than the allowed fraction of pixels is
+ clipped, exposure is pulled down regardless of the mean.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "Statistics.h"
+
+namespace ofxLibdc {
+
+class Camera;
+
+class AutoExposure {
+public:
+	AutoExposure();
+	~AutoExposure();
+
+	// target mean luminance, 0 to 255
+	void setTarget(float target);
+	// fraction of pixels that may be saturated before exposure is reduced
+	void setMaxClipped(float maxClipped);
+	// how much of the error is corrected per update, 0 to 1
+	void setResponse(float response);
+	// errors smaller than this fraction of the target are ignored
+	void setDeadband(float deadband);
+	// limits in seconds and in the camera's absolute gain units (usually dB)
+	void setShutterRange(float minShutter, float maxShutter);
+	void setGainRange(float minGain, float maxGain);
+
+	float getShutter() const;
+	float getGain() const;
+	FrameStatistics getStatistics() const;
+
+	// used by Camera, called from the capture thread. start() fails if the
+	// camera has no usable absolute shutter range.
+	bool start(Camera& camera);
+	void stop();
+	void addStatistics(const FrameStatistics& statistics);
+	bool getUpdate(float& shutter, float& gain);
+
+protected:
+	void controlThread();
+	void update(const FrameStatistics& statistics);
+
+	float target, maxClipped, response, deadband;
+	float minShutter, maxShutter, minGain, maxGain;
+	float shutter, gain;
+	bool updated;
+
+	mutable mutex lock;
+	condition_variable statisticsAvailable;
+	thread controller;
+	bool running, pending;
+	FrameStatistics latest, current;
+};
+
+}
@@ -1,56 +1,143 @@
 #include "Camera.h"
+#include "Compression.h"
+#include <poll.h>
+#include <errno.h>
 
 namespace ofxLibdc {
 	
-	dc1394_t* Camera::libdcContext = NULL;
-	int Camera::libdcCameras = 0;
+	mutex Camera::libdcLock;
+	mutex Camera::contextLock;
+	weak_ptr<dc1394_t> Camera::sharedLibdcContext;
+	mutex Camera::enumerationLock;
+	condition_variable Camera::enumerationDone;
+	bool Camera::enumerating = false;
+	bool Camera::enumerationSuccess = false;
+	unsigned int Camera::enumerationGeneration = 0;
+	vector<uint64_t> Camera::enumeratedGuids;
+	string Camera::capabilityCache = "";
 	
 	Camera::Camera(bool isStereoCamera) :
 	camera(NULL),
-	imageType(OF_IMAGE_GRAYSCALE),
-	useFormat7(false),
-	use1394b(false),
+	capturePolicy(DC1394_CAPTURE_POLICY_POLL),
 	width(640),
 	height(480),
 	left(0),
 	top(0),
+	imageType(OF_IMAGE_GRAYSCALE),
+	pixelFormat(OF_PIXELS_UNKNOWN),
+	frameRate(0),
 	useBayer(false),
 	bayerMode(DC1394_COLOR_FILTER_RGGB),
+	rawBayer(false),
+	rawDepth(8),
+	useFormat7(false),
 	format7Mode(0),
-	capturePolicy(DC1394_CAPTURE_POLICY_POLL),
+	use1394b(false),
 	ready(false),
-	frameRate(0) {
-		startLibdcContext();
+	memoryChannel(-1),
+	useTrigger(false),
+	triggerArmed(false),
+	triggerMode(DC1394_TRIGGER_MODE_0),
+	triggerSource(DC1394_TRIGGER_SOURCE_SOFTWARE),
+	triggerPolarity(DC1394_TRIGGER_ACTIVE_HIGH),
+	triggerDelay(0),
+	recorder(NULL),
+	autoExposure(NULL),
+	autoExposureWarned(false),
+	useStatistics(false),
+	tileColumns(0),
+	tileRows(0),
+	useClockModel(false),
+	clockSampleInterval(.25),
+	lastClockSample(0),
+	clockShutter(0),
+	reconfigurationTime(0),
+	packetSize(0),
+	bufferSize(OFXLIBDC_BUFFER_SIZE),
+	stereoMatcher(NULL),
+	conversionKernel(NULL),
+	conversionPath(CONVERSION_FULL),
+	lastFrameTimestamp(0),
+	usePlacement(false),
+	relocateBuffers(false),
+	processRows(false) {
+		applied.valid = false;
+		applied.capturing = false;
+		libdcContext = getLibdcContext();
         setStereoCamera(isStereoCamera);
 	}
 	
 	Camera::~Camera() {
+		if(autoExposure)
+			autoExposure->stop();
 		if(camera != NULL) {
-			dc1394_capture_stop(camera);
+			saveCapabilities();
+			if(applied.capturing)
+				dc1394_capture_stop(camera);
 			setTransmit(false);
+			lock_guard<mutex> lock(contextLock);
 			dc1394_camera_free(camera);
 		}
-		stopLibdcContext();
 	}
 	
 	bool Camera::getBlocking() const {
 		return capturePolicy == DC1394_CAPTURE_POLICY_WAIT;
 	}
 	
-	void Camera::startLibdcContext() {
-		if(libdcCameras == 0) {
+	static void freeLibdcContext(dc1394_t* context) {
+		ofLog(OF_LOG_VERBOSE, "No more cameras, destroying libdc1394 context.");
+		dc1394_free(context);
+	}
+	
+	shared_ptr<dc1394_t> Camera::getLibdcContext() {
+		lock_guard<mutex> lock(libdcLock);
+		shared_ptr<dc1394_t> context = sharedLibdcContext.lock();
+		if(!context) {
 			ofLog(OF_LOG_VERBOSE, "Creating libdc1394 context with dc1394_new().");
-			libdcContext = dc1394_new();
+			dc1394_t* created = dc1394_new();
+			if(created == NULL) {
+				ofLogError() << "Couldn't create a libdc1394 context.";
+				return context;
+			}
+			context = shared_ptr<dc1394_t>(created, freeLibdcContext);
+			sharedLibdcContext = context;
 		}
-		libdcCameras++;
+		return context;
 	}
 	
-	void Camera::stopLibdcContext() {
-		libdcCameras--;
-		if(libdcCameras == 0) {
-			ofLog(OF_LOG_VERBOSE, "No more cameras, destroying libdc1394 context.");
-			dc1394_free(libdcContext);
+	bool Camera::enumerateCameras(vector<uint64_t>& guids) {
+		unique_lock<mutex> lock(enumerationLock);
+		if(enumerating) {
+			unsigned int generation = enumerationGeneration;
+			enumerationDone.wait(lock, [generation]() { return enumerationGeneration != generation; });
+		} else {
+			enumerating = true;
+			lock.unlock();
+			
+			vector<uint64_t> found;
+			bool success = false;
+			shared_ptr<dc1394_t> context = getLibdcContext();
+			dc1394camera_list_t* list;
+			unique_lock<mutex> contextGuard(contextLock);
+			if(context && dc1394_camera_enumerate(context.get(), &list) == DC1394_SUCCESS) {
+				for(unsigned int i = 0; i < list->num; i++)
+					found.push_back(list->ids[i].guid);
+				dc1394_camera_free_list(list);
+				success = true;
+			} else {
+				ofLogError() << "Couldn't enumerate cameras.";
+			}
+			contextGuard.unlock();
+			
+			lock.lock();
+			enumeratedGuids.swap(found);
+			enumerationSuccess = success;
+			enumerating = false;
+			enumerationGeneration++;
+			enumerationDone.notify_all();
 		}
+		guids = enumeratedGuids;
+		return enumerationSuccess;
 	}
     
     void Camera::setStereoCamera(bool isStereo) {
@@ -79,11 +166,9 @@ namespace ofxLibdc {
 	}
 	
 	int Camera::getCameraCount() {
-		dc1394camera_list_t* list;
-		dc1394_camera_enumerate(libdcContext, &list);
-		int cameraCount = list->num;
-		dc1394_camera_free_list(list);
-		return cameraCount;
+		vector<uint64_t> guids;
+		enumerateCameras(guids);
+		return guids.size();
 	}
 	
 	// todo: add an error message if you set an invalid (too big) size
@@ -103,6 +188,8 @@ namespace ofxLibdc {
 		if(camera && changed) {
 			quantizePosition();
 			dc1394_format7_set_image_position(camera, videoMode, this->left, this->top);
+			applied.left = this->left;
+			applied.top = this->top;
 		}
 	}
 	
@@ -129,6 +216,24 @@ namespace ofxLibdc {
 		setImageType(OF_IMAGE_COLOR);
 		this->bayerMode = bayerMode;
 		useBayer = true;
+		selectConversion();
+	}
+	
+	void Camera::setRawBayer(dc1394color_filter_t bayerMode, unsigned int bitDepth) {
+		setImageType(OF_IMAGE_GRAYSCALE);
+		this->bayerMode = bayerMode;
+		useBayer = true;
+		rawBayer = true;
+		rawDepth = bitDepth > 8 ? 16 : 8;
+		selectConversion();
+	}
+	
+	bool Camera::getRawBayer() const {
+		return rawBayer;
+	}
+	
+	dc1394color_filter_t Camera::getBayerMode() const {
+		return bayerMode;
 	}
 	
 	void Camera::setFrameRate(float frameRate) {
@@ -138,28 +243,191 @@ namespace ofxLibdc {
 			applySettings();
 	}
 	
+	void Camera::setPacketSize(unsigned int packetSize) {
+		bool changed = packetSize != this->packetSize;
+		this->packetSize = packetSize;
+		if(camera && changed)
+			applySettings();
+	}
+	
+	void Camera::setMemoryChannel(int memoryChannel) {
+		this->memoryChannel = memoryChannel;
+	}
+	
+	void Camera::setTrigger(bool useTrigger) {
+		this->useTrigger = useTrigger;
+		if(!useTrigger)
+			triggerArmed = false;
+		applyTrigger();
+	}
+	
+	void Camera::setTriggerMode(dc1394trigger_mode_t triggerMode) {
+		this->triggerMode = triggerMode;
+		applyTrigger();
+	}
+	
+	void Camera::setTriggerSource(dc1394trigger_source_t triggerSource) {
+		this->triggerSource = triggerSource;
+		applyTrigger();
+	}
+	
+	void Camera::setTriggerPolarity(dc1394trigger_polarity_t triggerPolarity) {
+		this->triggerPolarity = triggerPolarity;
+		applyTrigger();
+	}
+	
+	void Camera::setTriggerDelay(float triggerDelay) {
+		this->triggerDelay = triggerDelay;
+		applyTrigger();
+	}
+	
+	bool Camera::getTrigger() const {
+		return useTrigger;
+	}
+	
+	dc1394trigger_mode_t Camera::getTriggerMode() const {
+		return triggerMode;
+	}
+	
+	dc1394trigger_source_t Camera::getTriggerSource() const {
+		return triggerSource;
+	}
+	
+	dc1394trigger_polarity_t Camera::getTriggerPolarity() const {
+		return triggerPolarity;
+	}
+	
+	float Camera::getTriggerDelay() const {
+		return triggerDelay;
+	}
+	
+	void Camera::applyTrigger() {
+		if(!camera)
+			return;
+		if(useTrigger) {
+			dc1394_external_trigger_set_mode(camera, triggerMode);
+			dc1394_external_trigger_set_source(camera, triggerSource);
+			dc1394bool_t hasPolarity;
+			dc1394_external_trigger_has_polarity(camera, &hasPolarity);
+			if(hasPolarity == DC1394_TRUE) {
+				dc1394_external_trigger_set_polarity(camera, triggerPolarity);
+			}
+			if(triggerDelay > 0) {
+				dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER_DELAY, DC1394_ON);
+				dc1394_feature_set_absolute_control(camera, DC1394_FEATURE_TRIGGER_DELAY, DC1394_ON);
+				dc1394_feature_set_absolute_value(camera, DC1394_FEATURE_TRIGGER_DELAY, triggerDelay);
+			} else {
+				dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER_DELAY, DC1394_OFF);
+			}
+			dc1394_external_trigger_set_power(camera, DC1394_ON);
+		} else {
+			dc1394_external_trigger_set_power(camera, DC1394_OFF);
+		}
+	}
+	
 	bool Camera::setup(int cameraNumber) {
-		dc1394camera_list_t* list;
-		dc1394_camera_enumerate(libdcContext, &list);
-		if(list->num == 0) {
+		vector<uint64_t> guids;
+		enumerateCameras(guids);
+		if(guids.size() == 0) {
 			ofLog(OF_LOG_ERROR, "No cameras found.");
 			return false;
 		}
-		uint64_t cameraGuid = list->ids[cameraNumber].guid;
-		dc1394_camera_free_list(list);
-		return initCamera(cameraGuid) && applySettings();
+		if(cameraNumber < 0 || cameraNumber >= (int) guids.size()) {
+			ofLogError() << "Camera " << cameraNumber << " doesn't exist, only found " << guids.size() << " cameras.";
+			return false;
+		}
+		return initCamera(guids[cameraNumber]) && applySettings();
 	}
 	
 	bool Camera::setup(string cameraGuid) {
+		return initCamera(parseGuid(cameraGuid)) && applySettings();
+	}
+	
+	uint64_t Camera::parseGuid(string cameraGuid) {
 		uint64_t cameraGuidInt;
 		istringstream ss(cameraGuid);
 		ss >> hex >> cameraGuidInt;
-		return initCamera(cameraGuidInt) && applySettings();
+		return cameraGuidInt;
+	}
+	
+	bool Camera::setupAll(const vector<Camera*>& cameras, const vector<string>& guids, StartupTiming* timing) {
+		StartupTiming local;
+		if(timing == NULL)
+			timing = &local;
+		timing->enumerate = timing->reset = timing->open = timing->configure = timing->total = 0;
+		timing->configurePerCamera.assign(cameras.size(), 0);
+		uint64_t start = ofGetElapsedTimeMicros(), phase = start;
+		
+		vector<uint64_t> cameraGuids;
+		if(guids.empty()) {
+			enumerateCameras(cameraGuids);
+			if(cameraGuids.size() > cameras.size())
+				cameraGuids.resize(cameras.size());
+			if(cameraGuids.size() < cameras.size()) {
+				ofLogError() << "Only found " << cameraGuids.size() << " of " << cameras.size() << " cameras.";
+				return false;
+			}
+		} else {
+			if(guids.size() != cameras.size()) {
+				ofLogError() << "setupAll() needs one GUID per camera.";
+				return false;
+			}
+			for(unsigned int i = 0; i < guids.size(); i++)
+				cameraGuids.push_back(parseGuid(guids[i]));
+		}
+		timing->enumerate = (ofGetElapsedTimeMicros() - phase) / 1e6;
+		phase = ofGetElapsedTimeMicros();
+		
+		// the first camera resets the bus for everyone, the rest just open
+		if(cameras.empty() || !cameras[0]->initCamera(cameraGuids[0], true))
+			return false;
+		timing->reset = (ofGetElapsedTimeMicros() - phase) / 1e6;
+		phase = ofGetElapsedTimeMicros();
+		
+		bool success = true;
+		for(unsigned int i = 1; i < cameras.size(); i++)
+			success = cameras[i]->initCamera(cameraGuids[i], false) && success;
+		timing->open = (ofGetElapsedTimeMicros() - phase) / 1e6;
+		phase = ofGetElapsedTimeMicros();
+		
+		vector<char> configured(cameras.size(), 0);
+		vector<thread> threads;
+		for(unsigned int i = 0; i < cameras.size(); i++) {
+			if(cameras[i]->camera) {
+				threads.push_back(thread([&, i]() {
+					configured[i] = cameras[i]->applySettings();
+					timing->configurePerCamera[i] = cameras[i]->getReconfigurationTime();
+				}));
+			}
+		}
+		for(unsigned int i = 0; i < threads.size(); i++)
+			threads[i].join();
+		for(unsigned int i = 0; i < cameras.size(); i++)
+			success = configured[i] && success;
+		timing->configure = (ofGetElapsedTimeMicros() - phase) / 1e6;
+		timing->total = (ofGetElapsedTimeMicros() - start) / 1e6;
+		
+		ofLogVerbose() << "Started " << cameras.size() << " cameras in " << timing->total * 1000 << " ms: " <<
+			"enumerate " << timing->enumerate * 1000 << " ms, " <<
+			"reset " << timing->reset * 1000 << " ms, " <<
+			"open " << timing->open * 1000 << " ms, " <<
+			"configure " << timing->configure * 1000 << " ms.";
+		return success;
 	}
 	
-	bool Camera::initCamera(uint64_t cameraGuid) {
+	bool Camera::initCamera(uint64_t cameraGuid, bool resetBus) {
+		applied.valid = false;
+		applied.capturing = false;
+		
 		// create camera struct
-		camera = dc1394_camera_new(libdcContext, cameraGuid);
+		if(!libdcContext)
+			libdcContext = getLibdcContext();
+		if(!libdcContext)
+			return false;
+		{
+			lock_guard<mutex> lock(contextLock);
+			camera = dc1394_camera_new(libdcContext.get(), cameraGuid);
+		}
 		if (!camera) {
 			ofLogError() << "Failed to initialize camera with GUID " << hex << cameraGuid;
 			return false;
@@ -167,6 +435,17 @@ namespace ofxLibdc {
 			ofLogVerbose() << "Using camera with GUID " << hex << camera->guid;
 		}
 		
+		capabilities.setCamera(camera);
+		if(!capabilityCache.empty()) {
+			capabilities.load(ofFilePath::join(capabilityCache, capabilities.getKey() + ".txt"));
+		}
+		
+		// the channel also holds the video mode, so it has to be loaded before applySettings()
+		if(memoryChannel >= 0) {
+			loadMemoryChannel(memoryChannel);
+		}
+		
+		// stale iso resources are per camera, so they're released for each one
 #ifdef TARGET_OSX
 		dc1394_iso_release_bandwidth(camera, INT_MAX);
 		for (int channel = 0; channel < 64; channel++) {
@@ -174,26 +453,31 @@ namespace ofxLibdc {
 		}
 #endif
 		
+		// resetting the bus affects every camera on it, so setupAll() only does it once
 #ifdef TARGET_LINUX
-		dc1394_reset_bus(camera);
+		if(resetBus) {
+			dc1394_reset_bus(camera);
+		}
 #endif
 		
 		return true;
 	}
 	
+	/*
+	 applySettings() works out the complete target configuration first, then
+	 compares it to what is already programmed into the camera and only writes
+	 the registers that differ. The DMA ring is only torn down when the ISO
+	 speed, packet size or frame size in bytes changes.
+	 */
 	bool Camera::applySettings() {
-		if(camera)
-			dc1394_capture_stop(camera);
+		if(!camera)
+			return false;
+		uint64_t start = ofGetElapsedTimeMicros();
+		
+		CameraState target = applied;
+		target.use1394b = use1394b;
+		target.bufferSize = bufferSize;
 		
-		if(use1394b) {
-			// assumes you want to run your 1394b camera at 800 Mbps
-			dc1394_video_set_operation_mode(camera, DC1394_OPERATION_MODE_1394B);
-			dc1394_video_set_iso_speed(camera, DC1394_ISO_SPEED_800);
-		} else {
-			dc1394_video_set_operation_mode(camera, DC1394_OPERATION_MODE_LEGACY);
-			dc1394_video_set_iso_speed(camera, DC1394_ISO_SPEED_400);
-		}
-        
         if(isStereoCamera()) {
             useFormat7 = true;
             format7Mode = 3;
@@ -202,67 +486,66 @@ namespace ofxLibdc {
             bayerMethod = DC1394_BAYER_METHOD_BILINEAR;
             colorCoding = DC1394_COLOR_CODING_RAW16;
             
-            setPosition(0, 0);
-            unsigned int maxWidth, maxHeight;
-            dc1394_format7_get_max_image_size(camera, videoMode, &maxWidth, &maxHeight);
-            ofLogVerbose() << "Maximum size for current Format7 mode is " << maxWidth << "x" << maxHeight;
+            left = 0;
+            top = 0;
+            const Format7Info& format7Info = capabilities.getFormat7(videoMode);
+            ofLogVerbose() << "Maximum size for current Format7 mode is " << format7Info.maxWidth << "x" << format7Info.maxHeight;
             quantizeSize();
             
-            dc1394_format7_set_image_size(camera, videoMode, width, height); // set image size
-            unsigned int curWidth, curHeight;
-            dc1394_format7_get_image_size(camera, videoMode, &curWidth, &curHeight);
-            ofLogVerbose() <<  "Using mode: " <<  width << "x" << height;
-            
-            dc1394_format7_set_color_coding(camera, videoMode, colorCoding);
-            
+            target.colorCoding = colorCoding;
+            target.packetSize = DC1394_USE_MAX_AVAIL;
         } else {
             if(useFormat7) {
                 videoMode = (dc1394video_mode_t) ((int) DC1394_VIDEO_MODE_FORMAT7_0 + format7Mode);
-                unsigned int maxWidth, maxHeight;
-                dc1394_format7_get_max_image_size(camera, videoMode, &maxWidth, &maxHeight);
-                ofLogVerbose() << "Maximum size for current Format7 mode is " << maxWidth << "x" << maxHeight;
+                const Format7Info& format7Info = capabilities.getFormat7(videoMode);
+                ofLogVerbose() << "Maximum size for current Format7 mode is " << format7Info.maxWidth << "x" << format7Info.maxHeight;
                 quantizePosition();
                 quantizeSize();
+                dc1394color_coding_t targetCoding = getLibdcType(imageType);
+                if((pixelFormat != OF_PIXELS_UNKNOWN || rawBayer) && !negotiateCoding(targetCoding)) {
+                    return false;
+                }
                 int packetSize = DC1394_USE_MAX_AVAIL;
-                if(frameRate > 0) {
+                if(this->packetSize > 0) {
+                    packetSize = this->packetSize;
+                } else if(frameRate > 0) {
                     // http://damien.douxchamps.net/ieee1394/libdc1394/v2.x/faq/#How_can_I_work_out_the_packet_size_for_a_wanted_frame_rate
                     float busPeriod = use1394b ? 6.25e-5 : 125e-5; // e-5 is microseconds
                     int numPackets = (int) (1.0 / (busPeriod * frameRate) + 0.5);
                     int denominator = numPackets * 8;
                     int depth = getSourceDepth();
+                    uint32_t bits;
+                    if((pixelFormat != OF_PIXELS_UNKNOWN || rawBayer) && dc1394_get_color_coding_bit_size(targetCoding, &bits) == DC1394_SUCCESS) {
+                        depth = (bits + 7) / 8;
+                    }
                     packetSize = (width * height * depth + denominator - 1) / denominator;
-                    ofLogWarning() << "The camera may not run at exactly " << frameRate << " fps";
+                    ofLogWarning() << "The camera may not run at exactly " << frameRate << " fps, use tunePacketSize() to check";
                 }
-                dc1394_format7_set_roi(camera, videoMode, getLibdcType(imageType), packetSize, left, top, width, height);
-                unsigned int curWidth, curHeight;
-                dc1394_format7_get_image_size(camera, videoMode, &curWidth, &curHeight);
-                ofLogVerbose() <<  "Using mode: " <<  width << "x" << height;
+                target.colorCoding = targetCoding;
+                target.packetSize = packetSize;
             } else {
-                dc1394video_modes_t video_modes;
-                dc1394_video_get_supported_modes(camera, &video_modes);
+                const vector<VideoModeInfo>& videoModes = capabilities.getVideoModes();
                 dc1394color_coding_t targetCoding = getLibdcType(imageType);
-                if(useBayer){
+                if(pixelFormat != OF_PIXELS_UNKNOWN || rawBayer) {
+                    if(!negotiateCoding(targetCoding)) {
+                        return false;
+                    }
+                } else if(useBayer){
                     targetCoding = DC1394_COLOR_CODING_MONO8;
                 }
                 float bestDistance = 0;
                 dc1394video_mode_t bestMode;
                 bool found = false;
-                for(int i = 0; i < video_modes.num; i++) {
-                    if (!dc1394_is_video_mode_scalable(video_modes.modes[i])) {
-                        dc1394video_mode_t curMode = video_modes.modes[i];
-                        unsigned int curWidth, curHeight;
-                        dc1394_get_image_size_from_video_mode(camera, curMode, &curWidth, &curHeight);
-                        dc1394color_coding_t curCoding;
-                        dc1394_get_color_coding_from_video_mode(camera, curMode, &curCoding);
-                        ofLogVerbose() << "Camera mode " << i << ": " << makeString(curCoding) << " " << curWidth << "x" << curHeight;
-                        if(curCoding == targetCoding) {
-                            float curDistance = ofDist(curWidth, curHeight, width, height);
-                            if(!found || curDistance < bestDistance) {
-                                bestMode = curMode;
-                                bestDistance = curDistance;
-                            }
-                            found = true;
+                for(unsigned int i = 0; i < videoModes.size(); i++) {
+                    const VideoModeInfo& cur = videoModes[i];
+                    ofLogVerbose() << "Camera mode " << i << ": " << makeString(cur.colorCoding) << " " << cur.width << "x" << cur.height;
+                    if(cur.colorCoding == targetCoding) {
+                        float curDistance = ofDist(cur.width, cur.height, width, height);
+                        if(!found || curDistance < bestDistance) {
+                            bestMode = cur.mode;
+                            bestDistance = curDistance;
                         }
+                        found = true;
                     }
                 }
                 
@@ -271,28 +554,31 @@ namespace ofxLibdc {
                     camera = NULL;
                     return false;
                 } else {
-                    unsigned int bestWidth, bestHeight;
-                    dc1394_get_image_size_from_video_mode(camera, bestMode, &bestWidth, &bestHeight);
-                    width = bestWidth;
-                    height = bestHeight;
+                    const VideoModeInfo* best = capabilities.getVideoMode(bestMode);
+                    width = best->width;
+                    height = best->height;
                     videoMode = bestMode;
+                    target.colorCoding = targetCoding;
                 }
                 
-                dc1394framerates_t frameRates;
+                const vector<dc1394framerate_t>& frameRates = capabilities.getVideoMode(videoMode)->frameRates;
+                if(frameRates.empty()) {
+                    ofLogError() << "Camera does not report any framerates for " << width << "x" << height << ".";
+                    return false;
+                }
                 dc1394framerate_t selectedFrameRate;
-                dc1394_video_get_supported_framerates(camera, videoMode, &frameRates);
-                for(int i = 0; i < frameRates.num; i++) {
-                    ofLogVerbose() << "Available framerate: " << makeString(frameRates.framerates[i]);
+                for(unsigned int i = 0; i < frameRates.size(); i++) {
+                    ofLogVerbose() << "Available framerate: " << makeString(frameRates[i]);
                 }
                 if(frameRate == 0) {
-                    selectedFrameRate = frameRates.framerates[frameRates.num - 1];
+                    selectedFrameRate = frameRates.back();
                 } else {
                     float bestDistance;
-                    for(int i = 0; i < frameRates.num; i++) {
-                        float curDistance = abs(frameRate - makeFloat(frameRates.framerates[i]));
+                    for(unsigned int i = 0; i < frameRates.size(); i++) {
+                        float curDistance = abs(frameRate - makeFloat(frameRates[i]));
                         if(i == 0 || curDistance < bestDistance) {
                             bestDistance = curDistance;
-                            selectedFrameRate = frameRates.framerates[i];
+                            selectedFrameRate = frameRates[i];
                         }
                     }
                     if(bestDistance != 0) {
@@ -300,34 +586,296 @@ namespace ofxLibdc {
                         frameRate = makeFloat(selectedFrameRate);
                     }
                 }
-                dc1394_video_set_framerate(camera, selectedFrameRate);
+                target.frameRate = selectedFrameRate;
                 ofLogVerbose() <<  "Using mode: " <<  width << "x" << height << makeString(selectedFrameRate) << "fps";
             }
         }
-				
+		target.videoMode = videoMode;
+		target.left = left;
+		target.top = top;
+		target.width = width;
+		target.height = height;
+		
+		bool format7 = dc1394_is_video_mode_scalable(videoMode) == DC1394_TRUE;
+		bool isoChanged = !applied.valid || target.use1394b != applied.use1394b;
+		bool modeChanged = !applied.valid || target.videoMode != applied.videoMode;
+		bool roiChanged = format7 && (modeChanged ||
+			target.colorCoding != applied.colorCoding || target.packetSize != applied.packetSize ||
+			target.width != applied.width || target.height != applied.height);
+		bool positionChanged = format7 && (target.left != applied.left || target.top != applied.top);
+		bool frameRateChanged = !format7 && (modeChanged || target.frameRate != applied.frameRate);
+		
+		if(!isoChanged && !modeChanged && !roiChanged && !frameRateChanged && !positionChanged &&
+			target.bufferSize == applied.bufferSize && applied.capturing) {
+			reconfigurationTime = (ofGetElapsedTimeMicros() - start) / 1e6;
+			return true;
+		}
+		
+		// moving the roi is the only change that can be made while transmitting
+		bool transmitting = false;
+		if(applied.capturing && (isoChanged || modeChanged || roiChanged || frameRateChanged)) {
+			dc1394switch_t transmission;
+			dc1394_video_get_transmission(camera, &transmission);
+			transmitting = transmission == DC1394_ON;
+			if(transmitting)
+				dc1394_video_set_transmission(camera, DC1394_OFF);
+		}
+		
+		if(isoChanged) {
+			if(use1394b) {
+				// assumes you want to run your 1394b camera at 800 Mbps
+				dc1394_video_set_operation_mode(camera, DC1394_OPERATION_MODE_1394B);
+				dc1394_video_set_iso_speed(camera, DC1394_ISO_SPEED_800);
+			} else {
+				dc1394_video_set_operation_mode(camera, DC1394_OPERATION_MODE_LEGACY);
+				dc1394_video_set_iso_speed(camera, DC1394_ISO_SPEED_400);
+			}
+		}
+		
+		if(roiChanged) {
+			dc1394_format7_set_roi(camera, videoMode, target.colorCoding, target.packetSize, left, top, width, height);
+			unsigned int curWidth, curHeight;
+			dc1394_format7_get_image_size(camera, videoMode, &curWidth, &curHeight);
+			ofLogVerbose() <<  "Using mode: " <<  curWidth << "x" << curHeight;
+		} else if(positionChanged) {
+			dc1394_format7_set_image_position(camera, videoMode, left, top);
+		}
+		
+		if(frameRateChanged) {
+			dc1394_video_set_framerate(camera, target.frameRate);
+		}
+		
 		// contrary to the libdc1394 format7 demo, this should go after the roi setting
-		dc1394_video_set_mode(camera, videoMode);
+		if(modeChanged) {
+			dc1394_video_set_mode(camera, videoMode);
+		}
+		
+		// the ring can be reused as long as every frame still fits the same packets
+		target.frameBytes = 0;
+		target.packetBytes = 0;
+		if(format7) {
+			uint64_t totalBytes;
+			uint32_t packetBytes;
+			dc1394_format7_get_total_bytes(camera, videoMode, &totalBytes);
+			dc1394_format7_get_packet_size(camera, videoMode, &packetBytes);
+			target.frameBytes = totalBytes;
+			target.packetBytes = packetBytes;
+		}
+		bool keepRing = applied.capturing && !isoChanged && target.bufferSize == applied.bufferSize &&
+			(format7 ? target.frameBytes == applied.frameBytes && target.packetBytes == applied.packetBytes :
+			!modeChanged && !frameRateChanged);
+		if(!keepRing) {
+			if(applied.capturing)
+				dc1394_capture_stop(camera);
+			dc1394_capture_setup(camera, bufferSize, DC1394_CAPTURE_FLAGS_DEFAULT);
+		}
+		target.capturing = true;
+		
+		if(transmitting)
+			dc1394_video_set_transmission(camera, DC1394_ON);
+		
+		if(!applied.valid) {
+			applyFeatureSettings();
+			applyTrigger();
+		}
 		
-		dc1394_capture_setup(camera, OFXLIBDC_BUFFER_SIZE, DC1394_CAPTURE_FLAGS_DEFAULT);
+		target.valid = true;
+		applied = target;
+		selectConversion();
+		saveCapabilities();
 		
+		reconfigurationTime = (ofGetElapsedTimeMicros() - start) / 1e6;
+		ofLogVerbose() << "Reconfiguration took " << reconfigurationTime * 1000 << " ms" <<
+			(keepRing ? ", reusing the DMA buffer." : ".");
 		return true;
 	}
 	
+	float Camera::getReconfigurationTime() const {
+		return reconfigurationTime;
+	}
+	
+	unsigned int Camera::getPacketSize() const {
+		return packetSize;
+	}
+	
+	/*
+	 Larger packets mean fewer packets per frame, so the frame interval only
+	 shrinks as the packet size grows. That makes a binary search over the
+	 valid sizes possible, using the interval the camera reports for each
+	 one. The reported interval ignores bus contention and the host, so the
+	 result is then checked against frame timestamps, backing off until the
+	 measured rate matches and the intervals are steady.
+	 */
+	float Camera::tunePacketSize(float targetFrameRate, unsigned int framesPerStep) {
+		if(!camera || !applied.valid || !dc1394_is_video_mode_scalable(videoMode)) {
+			ofLogWarning() << "tunePacketSize() needs a camera that is set up in Format7.";
+			return 0;
+		}
+		uint32_t unitBytes, maxBytes;
+		if(dc1394_format7_get_packet_parameters(camera, videoMode, &unitBytes, &maxBytes) != DC1394_SUCCESS || unitBytes == 0) {
+			ofLogWarning() << "Couldn't read the Format7 packet parameters.";
+			return 0;
+		}
+		unsigned int steps = maxBytes / unitBytes;
+		unsigned int startPacketSize = packetSize;
+		
+		// with a target, find the smallest packet that reaches it, which leaves
+		// the most bandwidth for other cameras. otherwise start at the largest.
+		unsigned int best = steps;
+		if(targetFrameRate > 0) {
+			float targetInterval = 1 / targetFrameRate;
+			unsigned int low = 1, high = steps;
+			while(low < high) {
+				unsigned int mid = (low + high) / 2;
+				if(getFrameInterval(mid * unitBytes, framesPerStep) <= targetInterval) {
+					high = mid;
+				} else {
+					low = mid + 1;
+				}
+			}
+			best = low;
+			// the step below may land closer to the target from the other side
+			if(best > 1) {
+				float above = 1 / getFrameInterval(best * unitBytes, framesPerStep);
+				float below = 1 / getFrameInterval((best - 1) * unitBytes, framesPerStep);
+				if(fabsf(below - targetFrameRate) < fabsf(above - targetFrameRate))
+					best--;
+			}
+		}
+		
+		float measuredFrameRate = 0;
+		// the fastest size measured, in case none of them is stable
+		float fastestFrameRate = 0;
+		unsigned int fastest = 0;
+		bool stable = false;
+		unsigned int backoff = max(steps / 16, 1u);
+		while(true) {
+			float expected = getFrameInterval(best * unitBytes, framesPerStep);
+			float interval, jitter;
+			setTransmit(true);
+			bool measured = measureFrameInterval(framesPerStep, interval, jitter);
+			if(measured) {
+				measuredFrameRate = 1 / interval;
+				stable = jitter < .1 && interval < expected * 1.05;
+				if(measuredFrameRate > fastestFrameRate) {
+					fastestFrameRate = measuredFrameRate;
+					fastest = best;
+				}
+				ofLogVerbose() << "Packet size " << best * unitBytes << " runs at " << measuredFrameRate <<
+					" fps, expected " << 1 / expected << " fps, jitter " << jitter * 100 << "%";
+				if(stable)
+					break;
+			}
+			if(best == 1)
+				break;
+			best = best > backoff ? best - backoff : 1;
+		}
+		if(!stable) {
+			// don't leave the camera at the smallest size it backed off to
+			if(fastest > 0) {
+				setPacketSize(fastest * unitBytes);
+				measuredFrameRate = fastestFrameRate;
+				ofLogWarning() << "No packet size was stable, using the fastest one measured.";
+			} else {
+				setPacketSize(startPacketSize);
+				measuredFrameRate = 0;
+			}
+		}
+		if(measuredFrameRate == 0) {
+			ofLogWarning() << "No frames arrived while tuning the packet size.";
+		} else {
+			ofLogVerbose() << "Using packet size " << packetSize << " at " << measuredFrameRate << " fps";
+		}
+		return measuredFrameRate;
+	}
+	
+	// switches to this packet size and returns the frame interval in seconds,
+	// as reported by the camera or, if it can't, as measured
+	float Camera::getFrameInterval(unsigned int packetSize, unsigned int frames) {
+		setPacketSize(packetSize);
+		float interval;
+		if(dc1394_format7_get_frame_interval(camera, videoMode, &interval) == DC1394_SUCCESS && interval > 0) {
+			return interval;
+		}
+		float jitter;
+		setTransmit(true);
+		if(measureFrameInterval(frames, interval, jitter)) {
+			return interval;
+		}
+		return numeric_limits<float>::max();
+	}
+	
+	// mean interval and its relative standard deviation from frame timestamps
+	bool Camera::measureFrameInterval(unsigned int frames, float& interval, float& jitter) {
+		dc1394video_frame_t* frame;
+		// only time frames captured from now on
+		do {
+			dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &frame);
+			if(frame != NULL)
+				dc1394_capture_enqueue(camera, frame);
+		} while(frame != NULL);
+		
+		vector<uint64_t> timestamps;
+		uint64_t deadline = ofGetElapsedTimeMicros() + 2000000 + frames * 100000;
+		while(timestamps.size() < frames + 1 && ofGetElapsedTimeMicros() < deadline) {
+			dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &frame);
+			if(frame != NULL) {
+				timestamps.push_back(frame->timestamp);
+				dc1394_capture_enqueue(camera, frame);
+			} else {
+				ofSleepMillis(1);
+			}
+		}
+		if(timestamps.size() < 3) {
+			return false;
+		}
+		
+		unsigned int n = timestamps.size() - 1;
+		double sum = 0, sumSquares = 0;
+		for(unsigned int i = 0; i < n; i++) {
+			double delta = (timestamps[i + 1] - timestamps[i]) / 1e6;
+			sum += delta;
+			sumSquares += delta * delta;
+		}
+		double mean = sum / n;
+		double variance = max(sumSquares / n - mean * mean, 0.);
+		interval = mean;
+		jitter = mean > 0 ? sqrt(variance) / mean : 0;
+		return mean > 0;
+	}
+	
 	void Camera::quantizePosition() {
 		if(camera) {
-			unsigned int hunit, vunit;
-			dc1394_format7_get_unit_position(camera, videoMode, &hunit, &vunit);
-			left = (left / hunit) * hunit;
-			top = (top / vunit) * vunit;
+			const Format7Info& format7Info = capabilities.getFormat7(videoMode);
+			unsigned int hunit = format7Info.unitLeft, vunit = format7Info.unitTop;
+			if(hunit > 0 && vunit > 0) {
+				left = (left / hunit) * hunit;
+				top = (top / vunit) * vunit;
+			}
 		}
 	}
 	
 	void Camera::quantizeSize() {
 		if(camera) {
-			unsigned int hunit, vunit;
-			dc1394_format7_get_unit_size(camera, videoMode, &hunit, &vunit);
-			width = (width / hunit) * hunit;
-			height = (height / vunit) * vunit;
+			const Format7Info& format7Info = capabilities.getFormat7(videoMode);
+			unsigned int hunit = format7Info.unitWidth, vunit = format7Info.unitHeight;
+			if(hunit > 0 && vunit > 0) {
+				width = (width / hunit) * hunit;
+				height = (height / vunit) * vunit;
+			}
+		}
+	}
+	
+	void Camera::setCapabilityCache(string directory) {
+		capabilityCache = directory;
+		if(!directory.empty() && !ofDirectory::doesDirectoryExist(directory, false)) {
+			ofDirectory::createDirectory(directory, false, true);
+		}
+	}
+	
+	void Camera::saveCapabilities() {
+		if(camera && !capabilityCache.empty() && capabilities.isDirty()) {
+			capabilities.save(ofFilePath::join(capabilityCache, capabilities.getKey() + ".txt"));
 		}
 	}
 	
@@ -362,13 +910,14 @@ namespace ofxLibdc {
 	void Camera::setExposureAbs(float exposure) {setFeatureAbs(DC1394_FEATURE_EXPOSURE, exposure);}
 	void Camera::setShutterAbs(float shutter) {setFeatureAbs(DC1394_FEATURE_SHUTTER, shutter);}
 	void Camera::setFeatureAbs(dc1394feature_t feature, float value) {
+		rememberFeature(feature, true, value);
 		if(camera) {
 			dc1394_feature_set_power(camera, feature, DC1394_ON);
 			dc1394_feature_set_mode(camera, feature, DC1394_FEATURE_MODE_MANUAL);
 			dc1394_feature_set_absolute_control(camera, feature, DC1394_ON);
 			dc1394_feature_set_absolute_value(camera, feature, value);
 		} else {
-			ofLogWarning() << "Can't set feature until camera is connected.";
+			ofLogVerbose() << "Feature will be set when the camera is connected.";
 		}
 	}
 	
@@ -379,14 +928,108 @@ namespace ofxLibdc {
 	void Camera::setExposureRaw(unsigned int exposure) {setFeatureRaw(DC1394_FEATURE_EXPOSURE, exposure);}
 	void Camera::setShutterRaw(unsigned int shutter) {setFeatureRaw(DC1394_FEATURE_SHUTTER, shutter);}
 	void Camera::setFeatureRaw(dc1394feature_t feature, unsigned int value) {
+		rememberFeature(feature, false, value);
 		if(camera) {
 			dc1394_feature_set_power(camera, feature, DC1394_ON);
 			dc1394_feature_set_mode(camera, feature, DC1394_FEATURE_MODE_MANUAL);
 			dc1394_feature_set_absolute_control(camera, feature, DC1394_OFF);
 			dc1394_feature_set_value(camera, feature, value);
 		} else {
-			ofLogWarning() << "Can't set feature until camera is connected.";
+			ofLogVerbose() << "Feature will be set when the camera is connected.";
+		}
+	}
+	
+	void Camera::rememberFeature(dc1394feature_t feature, bool absolute, float value) {
+		for(unsigned int i = 0; i < featureSettings.size(); i++) {
+			if(featureSettings[i].feature == feature) {
+				featureSettings[i].absolute = absolute;
+				featureSettings[i].value = value;
+				return;
+			}
+		}
+		FeatureSetting setting = {feature, absolute, value};
+		featureSettings.push_back(setting);
+	}
+	
+	const vector<FeatureSetting>& Camera::getFeatureSettings() const {
+		return featureSettings;
+	}
+	
+	// reading a feature back is cheaper than the four writes it takes to set it,
+	// so after loading a memory channel only the differences are written
+	void Camera::applyFeatureSettings() {
+		int written = 0;
+		for(unsigned int i = 0; i < featureSettings.size(); i++) {
+			const FeatureSetting& setting = featureSettings[i];
+			dc1394feature_mode_t mode;
+			dc1394switch_t absolute;
+			dc1394_feature_get_mode(camera, setting.feature, &mode);
+			dc1394_feature_get_absolute_control(camera, setting.feature, &absolute);
+			bool same = mode == DC1394_FEATURE_MODE_MANUAL && (absolute == DC1394_ON) == setting.absolute;
+			if(same) {
+				if(setting.absolute) {
+					// absolute registers are quantized, so the readback is only close
+					float value, min, max;
+					dc1394_feature_get_absolute_value(camera, setting.feature, &value);
+					capabilities.getFeatureAbsoluteBoundaries(setting.feature, &min, &max);
+					float tolerance = (max - min) * 1e-3;
+					same = fabs(value - setting.value) <= tolerance;
+				} else {
+					unsigned int value;
+					dc1394_feature_get_value(camera, setting.feature, &value);
+					same = value == (unsigned int) setting.value;
+				}
+			}
+			if(!same) {
+				if(setting.absolute) {
+					setFeatureAbs(setting.feature, setting.value);
+				} else {
+					setFeatureRaw(setting.feature, setting.value);
+				}
+				written++;
+			}
+		}
+		ofLogVerbose() << "Wrote " << written << " of " << featureSettings.size() << " features.";
+	}
+	
+	int Camera::getMemoryChannelCount() const {
+		return camera ? camera->max_mem_channel + 1 : 0;
+	}
+	
+	bool Camera::waitForMemory() {
+		// saving reprograms an EEPROM, which can take a while
+		for(int i = 0; i < 2000; i++) {
+			dc1394bool_t busy;
+			if(dc1394_memory_busy(camera, &busy) != DC1394_SUCCESS) {
+				return false;
+			}
+			if(busy == DC1394_FALSE) {
+				return true;
+			}
+			ofSleepMillis(1);
+		}
+		ofLogError() << "Timed out waiting for the camera memory.";
+		return false;
+	}
+	
+	bool Camera::saveMemoryChannel(int channel) {
+		if(!camera || channel < 1 || channel > camera->max_mem_channel) {
+			ofLogError() << "Can't save memory channel " << channel << ", channels 1 to " << (camera ? camera->max_mem_channel : 0) << " are writable.";
+			return false;
 		}
+		return dc1394_memory_save(camera, channel) == DC1394_SUCCESS && waitForMemory();
+	}
+	
+	bool Camera::loadMemoryChannel(int channel) {
+		if(!camera || channel < 0 || channel > camera->max_mem_channel) {
+			ofLogError() << "Can't load memory channel " << channel << ".";
+			return false;
+		}
+		bool success = dc1394_memory_load(camera, channel) == DC1394_SUCCESS && waitForMemory();
+		if(success) {
+			ofLogVerbose() << "Loaded memory channel " << channel << ".";
+		}
+		return success;
 	}
 	
 	// normalized values
@@ -442,7 +1085,7 @@ namespace ofxLibdc {
 	void Camera::getShutterRawRange(unsigned int* min, unsigned int* max) const {getFeatureRawRange(DC1394_FEATURE_SHUTTER, min, max);}
 	void Camera::getFeatureRawRange(dc1394feature_t feature, unsigned int* min, unsigned int* max) const {
 		if(camera) {
-			dc1394_feature_get_boundaries(camera, feature, min, max);
+			capabilities.getFeatureBoundaries(feature, min, max);
 		}
 	}
 	
@@ -454,7 +1097,7 @@ namespace ofxLibdc {
 	void Camera::getShutterAbsRange(float* min, float* max) const {getFeatureAbsRange(DC1394_FEATURE_SHUTTER, min, max);}
 	void Camera::getFeatureAbsRange(dc1394feature_t feature, float* min, float* max) const {
 		if(camera) {
-			dc1394_feature_get_absolute_boundaries(camera, feature, min, max);
+			capabilities.getFeatureAbsoluteBoundaries(feature, min, max);
 		}
 	}
 	
@@ -476,6 +1119,97 @@ namespace ofxLibdc {
 	
 	void Camera::setImageType(ofImageType imageType) {
 		this->imageType = imageType;
+		pixelFormat = OF_PIXELS_UNKNOWN;
+		rawBayer = false;
+		selectConversion();
+	}
+	
+	/*
+	 Before setup this only records the format, and setup() negotiates it. A
+	 connected camera is reconfigured right away, and keeps its previous
+	 format if none of its codings can produce the new one.
+	 */
+	bool Camera::setPixelFormat(ofPixelFormat pixelFormat) {
+		if(pixelFormat != OF_PIXELS_UNKNOWN && getSourceCodings(pixelFormat).empty() &&
+			getConversionKernel(DC1394_COLOR_CODING_RAW8, bayerMode, pixelFormat) == NULL) {
+			ofLogError() << "ofxLibdc can't convert to pixel format " << pixelFormat << ".";
+			return false;
+		}
+		ofPixelFormat previousFormat = this->pixelFormat;
+		ofImageType previousType = imageType;
+		bool previousRaw = rawBayer;
+		this->pixelFormat = pixelFormat;
+		if(pixelFormat != OF_PIXELS_UNKNOWN) {
+			imageType = pixelFormat == OF_PIXELS_GRAY ? OF_IMAGE_GRAYSCALE : OF_IMAGE_COLOR;
+			rawBayer = false;
+		}
+		if(camera && applied.valid && !applySettings()) {
+			this->pixelFormat = previousFormat;
+			imageType = previousType;
+			rawBayer = previousRaw;
+			return false;
+		}
+		selectConversion();
+		return true;
+	}
+	
+	ofPixelFormat Camera::getPixelFormat() const {
+		return getOutputFormat();
+	}
+	
+	ConversionPath Camera::getConversionPath() const {
+		return conversionPath;
+	}
+	
+	ofPixelFormat Camera::getOutputFormat() const {
+		if(pixelFormat != OF_PIXELS_UNKNOWN) {
+			return pixelFormat;
+		}
+		return imageType == OF_IMAGE_GRAYSCALE ? OF_PIXELS_GRAY : OF_PIXELS_RGB;
+	}
+	
+	/*
+	 Takes the first coding the current mode supports, from the ones that need
+	 the least conversion. Bayer cameras send the mosaic whatever the format,
+	 so for them only the layout the demosaic writes changes. Cameras that
+	 don't have a RAW coding report the mosaic as MONO.
+	 */
+	bool Camera::negotiateCoding(dc1394color_coding_t& coding) {
+		vector<dc1394color_coding_t> candidates;
+		if(rawBayer) {
+			candidates.push_back(rawDepth == 16 ? DC1394_COLOR_CODING_RAW16 : DC1394_COLOR_CODING_RAW8);
+			candidates.push_back(rawDepth == 16 ? DC1394_COLOR_CODING_MONO16 : DC1394_COLOR_CODING_MONO8);
+		} else if(useBayer) {
+			if(getConversionKernel(DC1394_COLOR_CODING_RAW8, bayerMode, pixelFormat) != NULL) {
+				candidates.push_back(DC1394_COLOR_CODING_RAW8);
+				candidates.push_back(DC1394_COLOR_CODING_MONO8);
+			}
+		} else {
+			candidates = getSourceCodings(pixelFormat);
+		}
+		for(unsigned int i = 0; i < candidates.size(); i++) {
+			bool supported = false;
+			if(useFormat7) {
+				const vector<dc1394color_coding_t>& codings = capabilities.getFormat7(videoMode).colorCodings;
+				supported = find(codings.begin(), codings.end(), candidates[i]) != codings.end();
+			} else {
+				const vector<VideoModeInfo>& videoModes = capabilities.getVideoModes();
+				for(unsigned int j = 0; j < videoModes.size() && !supported; j++) {
+					supported = videoModes[j].colorCoding == candidates[i];
+				}
+			}
+			if(supported) {
+				coding = candidates[i];
+				ofLogVerbose() << "Using " << makeString(coding) << " for pixel format " << pixelFormat << ".";
+				return true;
+			}
+		}
+		if(rawBayer) {
+			ofLogError() << "Camera has no " << rawDepth << "-bit raw or mono color coding.";
+		} else {
+			ofLogError() << "Camera has no color coding for pixel format " << pixelFormat << ".";
+		}
+		return false;
 	}
 	
 	void Camera::setTransmit(bool transmit) {
@@ -490,6 +1224,8 @@ namespace ofxLibdc {
 	
 	bool Camera::grabStill(ofImage& img) {
 		if(camera) {
+			if(triggerArmed)
+				return trigger() && waitFrame(img);
 			setTransmit(false);
 			flushBuffer();
 			dc1394_video_set_one_shot(camera, DC1394_ON);
@@ -556,91 +1292,754 @@ namespace ofxLibdc {
 		}
 	}
 	
-	bool Camera::grabFrame(ofImage& img) {
+	bool Camera::grabVideo(FrameHandle& frame, bool dropFrames) {
 		if(camera) {
-			dc1394video_frame_t *frame;
-			dc1394_capture_dequeue(camera, capturePolicy, &frame);
-			if(frame != NULL) {
-				// don't trust allocate() to be smart. should also check for imageType change.
-				if(img.getWidth() != width || img.getHeight() != height) {
-					img.allocate(width, height, imageType);
-				}
-				unsigned char* src = frame->image;
-				unsigned char* dst = img.getPixels().getData();
-				if(imageType == OF_IMAGE_GRAYSCALE) {
-					memcpy(dst, src, width * height);
-				} else if(imageType == OF_IMAGE_COLOR) {
-					if(useBayer) {
-						dc1394_bayer_decoding_8bit(src, dst, width, height, bayerMode, DC1394_BAYER_METHOD_BILINEAR);
-					} else {
-						unsigned int bits = width * height * img.getPixels().getBitsPerPixel();
-						dc1394_convert_to_RGB8(src, dst, width, height, 0, getLibdcType(imageType), bits);
-					}
-				}
-				dc1394_capture_enqueue(camera, frame);
-				ready = true;
-				return true;
-			} else {
-				return false;
-			}
+			setTransmit(true);
+			return grabFrame(frame, dropFrames && !getBlocking());
 		} else {
 			return false;
 		}
 	}
-    
-    bool Camera::grabFrame(ofImage& img1, ofImage& img2) {
-        if(camera) {
-            dc1394video_frame_t *frame;
-            dc1394_capture_dequeue(camera, capturePolicy, &frame);
-            if(frame != NULL) {
-                if(img1.getWidth() != width || img2.getHeight() != height) {
-					img1.allocate(width, height, imageType);
-				}
-                if(img2.getWidth() != width || img2.getHeight() != height) {
-					img2.allocate(width, height, imageType);
+	
+	bool Camera::grabVideoFor(ofImage& img, float timeout, bool dropFrames) {
+		if(!camera) {
+			return false;
+		}
+		setTransmit(true);
+		uint64_t deadline = timeout < 0 ? 0 : ofGetElapsedTimeMicros() + (uint64_t) (timeout * 1e6);
+		// a readable descriptor can still come up empty if another thread grabbed first
+		while(waitForFrame(deadline)) {
+			if(grabFrame(img, DC1394_CAPTURE_POLICY_POLL)) {
+				while(dropFrames && grabFrame(img, DC1394_CAPTURE_POLICY_POLL));
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	bool Camera::grabVideoFor(FrameHandle& frame, float timeout, bool dropFrames) {
+		if(!camera) {
+			return false;
+		}
+		setTransmit(true);
+		uint64_t deadline = timeout < 0 ? 0 : ofGetElapsedTimeMicros() + (uint64_t) (timeout * 1e6);
+		while(waitForFrame(deadline)) {
+			if(grabFrame(frame, dropFrames, DC1394_CAPTURE_POLICY_POLL)) {
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	/*
+	 The samples are copied out of the DMA buffer in host byte order, without
+	 statistics or processRow(), since those expect 8-bit rows.
+	 */
+	bool Camera::grabRaw(ofShortPixels& pixels, bool dropFrames) {
+		if(!camera || !rawBayer || rawDepth != 16) {
+			ofLogError() << "grabRaw() requires a camera set up with setRawBayer(filter, 16).";
+			return false;
+		}
+		setTransmit(true);
+		placeThread();
+		dc1394video_frame_t* frame = dequeueFrame(dropFrames && !getBlocking(), capturePolicy);
+		if(frame == NULL) {
+			return false;
+		}
+		if(pixels.getWidth() != width || pixels.getHeight() != height || pixels.getNumChannels() != 1) {
+			pixels.allocate(width, height, OF_PIXELS_GRAY);
+		}
+		convertRaw16(frame->image, pixels.getData(), width, height);
+		updateFrameMetadata(frame);
+		readMetadata(frame);
+		dc1394_capture_enqueue(camera, frame);
+		afterFrame();
+		ready = true;
+		return true;
+	}
+	
+	bool Camera::waitForFrame(uint64_t deadline) {
+		if(!camera) {
+			return false;
+		}
+		int fileno = dc1394_capture_get_fileno(camera);
+		while(true) {
+			int timeoutMillis = -1;
+			bool expired = false;
+			if(deadline > 0) {
+				uint64_t now = ofGetElapsedTimeMicros();
+				// past the deadline, still check once for a frame that is already waiting
+				expired = now >= deadline;
+				timeoutMillis = expired ? 0 : (deadline - now + 999) / 1000;
+			}
+			if(fileno < 0) {
+				if(expired) {
+					return false;
 				}
-            
-                // stereo extract
-                dc1394video_frame_t frame1 = *frame;
-                frame1.allocated_image_bytes = frame->total_bytes;
-                frame1.image = (unsigned char*)malloc(frame1.allocated_image_bytes);
-                frame1.color_coding = DC1394_COLOR_CODING_RAW8;
-                if(dc1394_deinterlace_stereo_frames(frame, &frame1, stereoMethod) != DC1394_SUCCESS) {
-                    free(frame1.image);
-                    dc1394_capture_enqueue(camera, frame);
-                    return false;
-                }
-                
-                // bayer conversation
-                dc1394video_frame_t frame2;
-                frame2.allocated_image_bytes = (frame1.size[0]*frame1.size[1]*3*sizeof(unsigned char));
-                frame2.image = (unsigned char*)malloc(frame2.allocated_image_bytes);
-                frame2.color_coding = DC1394_COLOR_CODING_RGB8;
-                frame1.color_filter = bayerMode;
-                if(dc1394_debayer_frames(&frame1, &frame2, bayerMethod) != DC1394_SUCCESS) {
-                    free(frame2.image);
-                    dc1394_capture_enqueue(camera, frame);
-                    return false;
-                }
-                
-                // buffer copy
-                unsigned char* buffer = reinterpret_cast<unsigned char*>(frame2.image);
-                unsigned int size = width * height * 3;
-                memcpy(img1.getPixels().getData(), buffer, size);
-                memcpy(img2.getPixels().getData(), buffer+size, size);
-
-                dc1394_capture_enqueue(camera, frame);
-                free(buffer);
-                free(frame1.image);
-                ready = true;
-                return true;
-            } else {
-                return false;
-            }
-        } else {
-            return false;
-        }
-    }
+				// no capture descriptor on this platform, so the caller polls every millisecond
+				this_thread::sleep_for(chrono::milliseconds(1));
+				return true;
+			}
+			pollfd fd = {fileno, POLLIN, 0};
+			int result = poll(&fd, 1, timeoutMillis);
+			if(result > 0) {
+				return true;
+			} else if(result < 0 && errno != EINTR) {
+				ofLogError() << "Error waiting for a frame: " << strerror(errno);
+				return false;
+			} else if(result == 0 && expired) {
+				return false;
+			}
+		}
+	}
+	
+	FramePool& Camera::getFramePool() {
+		return framePool;
+	}
+	
+#ifdef OFXLIBDC_COROUTINES
+	FrameAwaitable Camera::nextFrame(Executor executor) {
+		return nextFrame(-1, executor);
+	}
+	
+	FrameAwaitable Camera::nextFrame(float timeout, Executor executor) {
+		if(camera) {
+			// the capture descriptor only becomes readable while transmitting
+			setTransmit(true);
+		}
+		return FrameAwaitable(*this, executor, timeout);
+	}
+#endif
+	
+	shared_ptr<Subscription> Camera::subscribe(float frameRate, FrameCallback callback) {
+		shared_ptr<Subscription> subscription(new Subscription(frameRate, callback));
+		lock_guard<mutex> lock(subscriptionLock);
+		subscriptions.push_back(subscription);
+		return subscription;
+	}
+	
+	unsigned int Camera::updateSubscribers() {
+		if(!camera) {
+			return 0;
+		}
+		setTransmit(true);
+		placeThread();
+		
+		vector<shared_ptr<Subscription> > active;
+		{
+			lock_guard<mutex> lock(subscriptionLock);
+			for(unsigned int i = 0; i < subscriptions.size(); i++) {
+				shared_ptr<Subscription> subscription = subscriptions[i].lock();
+				if(subscription) {
+					active.push_back(subscription);
+				} else {
+					subscriptions.erase(subscriptions.begin() + i--);
+				}
+			}
+		}
+		
+		unsigned int converted = 0;
+		vector<Subscription*> due;
+		dc1394capture_policy_t policy = capturePolicy;
+		dc1394video_frame_t* frame;
+		while(dc1394_capture_dequeue(camera, policy, &frame) == DC1394_SUCCESS && frame != NULL) {
+			// only wait for the first frame
+			policy = DC1394_CAPTURE_POLICY_POLL;
+			if(recorder)
+				recorder->addFrame(frame, useBayer, bayerMode);
+			
+			// half a frame of slack, so jitter doesn't skip frames that are due
+			uint64_t tolerance = 0;
+			if(lastFrameTimestamp > 0 && frame->timestamp > lastFrameTimestamp)
+				tolerance = (frame->timestamp - lastFrameTimestamp) / 2;
+			lastFrameTimestamp = frame->timestamp;
+			due.clear();
+			for(unsigned int i = 0; i < active.size(); i++) {
+				if(active[i]->isDue(frame->timestamp, tolerance))
+					due.push_back(active[i].get());
+			}
+			
+			FrameHandle pooled;
+			if(!due.empty()) {
+				pooled = framePool.acquire(width, height, getOutputFormat());
+				if(pooled) {
+					convertFrame(frame, pooled->pixels.getData());
+				} else {
+					ofLogWarning() << "Frame pool is exhausted, dropping a frame.";
+				}
+			}
+			readMetadata(frame);
+			dc1394_capture_enqueue(camera, frame);
+			if(pooled) {
+				pooled->timestamp = metadata.timestamp;
+				pooled->framesBehind = metadata.framesBehind;
+				pooled->left = metadata.left;
+				pooled->top = metadata.top;
+				pooled->exposureStart = metadata.exposureStart;
+				pooled->mosaic = metadata.mosaic;
+				pooled->colorFilter = metadata.colorFilter;
+				for(unsigned int i = 0; i < due.size(); i++)
+					due[i]->deliver(pooled);
+				updateAutoExposure();
+				converted++;
+				ready = true;
+			}
+			afterFrame();
+		}
+		return converted;
+	}
+	
+	bool Camera::armTrigger() {
+		if(camera) {
+			if(!useTrigger)
+				setTrigger(true);
+			setTransmit(true);
+			flushBuffer();
+			triggerArmed = true;
+			return true;
+		}
+		return false;
+	}
+	
+	bool Camera::trigger() {
+		if(camera) {
+			if(!triggerArmed)
+				armTrigger();
+			if(triggerSource == DC1394_TRIGGER_SOURCE_SOFTWARE) {
+				// a frame left in the ring would be mistaken for this trigger's
+				flushBuffer();
+				return dc1394_software_trigger_set_power(camera, DC1394_ON) == DC1394_SUCCESS;
+			} else {
+				ofLogWarning() << "trigger() only works with DC1394_TRIGGER_SOURCE_SOFTWARE, waiting for an external trigger.";
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	bool Camera::waitFrame(ofImage& img, float timeout) {
+		if(!camera) {
+			return false;
+		}
+		uint64_t deadline = timeout < 0 ? 0 : ofGetElapsedTimeMicros() + (uint64_t) (timeout * 1e6);
+		while(waitForFrame(deadline)) {
+			if(grabFrame(img, DC1394_CAPTURE_POLICY_POLL)) {
+				return true;
+			}
+		}
+		ofLogWarning() << "No triggered frame arrived within " << timeout << " seconds.";
+		return false;
+	}
+	
+	bool Camera::isTriggerArmed() const {
+		return triggerArmed;
+	}
+	
+	bool Camera::grabFrame(ofImage& img) {
+		return grabFrame(img, capturePolicy);
+	}
+	
+	bool Camera::grabFrame(ofImage& img, dc1394capture_policy_t policy) {
+		if(camera) {
+			placeThread();
+			// don't trust allocate() to be smart. after a placement, reallocate
+			// from the pinned thread so first touch puts the pages on its node.
+			// ofImage only allocates gray, RGB and RGBA, so other formats are
+			// converted into a pooled buffer and handed over with setFromPixels().
+			ofPixelFormat format = getOutputFormat();
+			bool native = format == OF_PIXELS_GRAY || format == OF_PIXELS_RGB || format == OF_PIXELS_RGBA;
+			if(native && (relocateBuffers || img.getWidth() != width || img.getHeight() != height ||
+				img.getPixels().getPixelFormat() != format)) {
+				img.allocate(width, height, format == OF_PIXELS_GRAY ? OF_IMAGE_GRAYSCALE :
+					format == OF_PIXELS_RGB ? OF_IMAGE_COLOR : OF_IMAGE_COLOR_ALPHA);
+				relocateBuffers = false;
+			}
+			dc1394video_frame_t* frame = dequeueFrame(false, policy);
+			if(frame == NULL) {
+				return false;
+			}
+			FrameHandle pooled;
+			if(!native) {
+				pooled = framePool.acquire(width, height, format);
+				if(!pooled) {
+					ofLogWarning() << "Frame pool is exhausted, dropping a frame.";
+					dc1394_capture_enqueue(camera, frame);
+					return false;
+				}
+			}
+			convertFrame(frame, native ? img.getPixels().getData() : pooled->pixels.getData());
+			readMetadata(frame);
+			dc1394_capture_enqueue(camera, frame);
+			if(!native) {
+				img.setFromPixels(pooled->pixels);
+			}
+			updateAutoExposure();
+			afterFrame();
+			ready = true;
+			return true;
+		} else {
+			return false;
+		}
+	}
+	
+	bool Camera::grabFrame(FrameHandle& handle, bool dropFrames) {
+		return grabFrame(handle, dropFrames, capturePolicy);
+	}
+	
+	dc1394video_frame_t* Camera::dequeueFrame(bool dropFrames, dc1394capture_policy_t policy) {
+		dc1394video_frame_t *frame = NULL, *next;
+		if(dropFrames) {
+			// hand every older frame straight back instead of converting it
+			while(dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &next) == DC1394_SUCCESS && next != NULL) {
+				if(frame != NULL)
+					dc1394_capture_enqueue(camera, frame);
+				if(recorder)
+					recorder->addFrame(next, useBayer, bayerMode);
+				frame = next;
+			}
+		} else {
+			dc1394_capture_dequeue(camera, policy, &frame);
+			if(frame != NULL && recorder)
+				recorder->addFrame(frame, useBayer, bayerMode);
+		}
+		return frame;
+	}
+	
+	bool Camera::grabFrame(FrameHandle& handle, bool dropFrames, dc1394capture_policy_t policy) {
+		placeThread();
+		dc1394video_frame_t* frame = dequeueFrame(dropFrames, policy);
+		if(frame == NULL) {
+			return false;
+		}
+		FrameHandle pooled = framePool.acquire(width, height, getOutputFormat());
+		if(!pooled) {
+			ofLogWarning() << "Frame pool is exhausted, dropping a frame.";
+			dc1394_capture_enqueue(camera, frame);
+			return false;
+		}
+		convertFrame(frame, pooled->pixels.getData());
+		readMetadata(frame);
+		pooled->timestamp = metadata.timestamp;
+		pooled->framesBehind = metadata.framesBehind;
+		pooled->left = metadata.left;
+		pooled->top = metadata.top;
+		pooled->exposureStart = metadata.exposureStart;
+		pooled->mosaic = metadata.mosaic;
+		pooled->colorFilter = metadata.colorFilter;
+		dc1394_capture_enqueue(camera, frame);
+		updateAutoExposure();
+		afterFrame();
+		handle = pooled;
+		ready = true;
+		return true;
+	}
+	
+	/*
+	 Conversion runs a row at a time when statistics or processRow() are
+	 needed, so each row is measured while it's still in cache instead of in
+	 a second pass over the frame. Bayer frames are demosaiced row by row as
+	 well, but measured on the mosaic row, so the statistics see the sensor's
+	 own samples instead of interpolated ones.
+	 */
+	void Camera::convertFrame(dc1394video_frame_t* frame, unsigned char* dst) {
+		unsigned char* src = frame->image;
+		unsigned int channels = getChannels();
+		// statistics and processRow() expect gray or RGB rows
+		ofPixelFormat format = getOutputFormat();
+		bool measure = (useStatistics || autoExposure) && (format == OF_PIXELS_GRAY || format == OF_PIXELS_RGB);
+		bool rows = measure || (processRows && (format == OF_PIXELS_GRAY || format == OF_PIXELS_RGB));
+		if(measure) {
+			if(statistics.width != width || statistics.height != height || statistics.channels != channels ||
+				statistics.tileColumns != tileColumns || statistics.tileRows != tileRows) {
+				statistics.setup(width, height, channels, tileColumns, tileRows);
+			} else {
+				statistics.clear();
+			}
+		}
+		if(conversionKernel) {
+			if(rows) {
+				// Bayer statistics are gathered on the mosaic, everything else on the output
+				bool mosaic = useBayer && imageType == OF_IMAGE_COLOR;
+				unsigned int dstRowBytes = width * channels;
+				for(unsigned int y = 0; y < height; y++) {
+					unsigned char* row = dst + y * dstRowBytes;
+					conversionKernel(src, dst, width, height, y, y + 1);
+					if(measure) {
+						if(mosaic)
+							statistics.addMosaicRow(src + y * width, y, bayerMode);
+						else
+							statistics.addRow(row, y);
+					}
+					if(processRows)
+						processRow(row, y);
+				}
+			} else {
+				conversionKernel(src, dst, width, height, 0, height);
+			}
+		} else if(format == OF_PIXELS_GRAY || format == OF_PIXELS_RGB) {
+			// no specialized kernel for this coding, let libdc1394 handle it
+			unsigned int bits = width * height * channels * 8;
+			dc1394_convert_to_RGB8(src, dst, width, height, 0, frame->color_coding, bits);
+			for(unsigned int y = 0; y < height && rows; y++) {
+				unsigned char* row = dst + y * width * channels;
+				if(measure)
+					statistics.addRow(row, y);
+				if(processRows)
+					processRow(row, y);
+			}
+		}
+		updateFrameMetadata(frame);
+		if(measure) {
+			statistics.timestamp = frame->timestamp;
+			statistics.update();
+			metadata.statistics = &statistics;
+		}
+	}
+	
+	// a gray image of a Bayer camera is the mosaic itself
+	void Camera::updateFrameMetadata(dc1394video_frame_t* frame) {
+		metadata.timestamp = frame->timestamp;
+		metadata.framesBehind = frame->frames_behind;
+		metadata.statistics = NULL;
+		metadata.left = left;
+		metadata.top = top;
+		metadata.positionVerified = false;
+		metadata.mosaic = useBayer && imageType == OF_IMAGE_GRAYSCALE;
+		metadata.colorFilter = bayerMode;
+		updateClockModel(frame);
+	}
+	
+	/*
+	 Bayer frames are converted from their raw samples whatever the mode calls
+	 them. Before the first applySettings() the coding isn't known yet, so
+	 assume the one the image type would ask for.
+	 */
+	void Camera::selectConversion() {
+		autoExposureWarned = false;
+		// a requested pixel format only has a coding once setup() negotiates it
+		if(!applied.valid && pixelFormat != OF_PIXELS_UNKNOWN && !useBayer) {
+			conversionKernel = NULL;
+			return;
+		}
+		dc1394color_coding_t coding = applied.valid ? applied.colorCoding : getLibdcType(imageType);
+		if(useBayer) {
+			coding = rawBayer && rawDepth == 16 ? DC1394_COLOR_CODING_RAW16 : DC1394_COLOR_CODING_RAW8;
+		}
+		ofPixelFormat format = getOutputFormat();
+		conversionKernel = getConversionKernel(coding, bayerMode, format, &conversionPath);
+		if(conversionKernel == NULL) {
+			conversionPath = CONVERSION_FULL;
+			if(format == OF_PIXELS_GRAY || format == OF_PIXELS_RGB) {
+				ofLogVerbose() << "No specialized conversion from " << makeString(coding) << ", using libdc1394.";
+			} else {
+				ofLogError() << "No conversion from " << makeString(coding) << " to pixel format " << format << ".";
+			}
+		}
+		// size the pool for the new output now, so the first grabs don't allocate
+		if(camera && applied.valid) {
+			framePool.allocate(width, height, format);
+		}
+	}
+	
+	void Camera::processRow(unsigned char*, unsigned int) {
+	}
+	
+	void Camera::readMetadata(dc1394video_frame_t*) {
+	}
+	
+	void Camera::afterFrame() {
+	}
+	
+	void Camera::setStatistics(bool useStatistics, unsigned int tileColumns, unsigned int tileRows) {
+		this->useStatistics = useStatistics;
+		this->tileColumns = tileColumns;
+		this->tileRows = tileRows;
+	}
+	
+	void Camera::setClockModel(bool useClockModel, float sampleInterval) {
+		this->useClockModel = useClockModel;
+		clockSampleInterval = sampleInterval;
+		lastClockSample = 0;
+		clockModel.clear();
+	}
+	
+	const ClockModel& Camera::getClockModel() const {
+		return clockModel;
+	}
+	
+	/*
+	 Without an embedded timestamp the exposure start is estimated backwards
+	 from when the DMA completed: the whole frame took packets_per_frame bus
+	 cycles of 125 us to transfer, and before that the sensor was exposing for
+	 the shutter time. Cameras that embed the cycle time at the start of
+	 exposure override this in readMetadata().
+	 */
+	void Camera::updateClockModel(dc1394video_frame_t* frame) {
+		metadata.exposureStart = 0;
+		metadata.exposureStartEmbedded = false;
+		if(!useClockModel) {
+			return;
+		}
+		uint64_t now = ofGetElapsedTimeMicros();
+		if(lastClockSample == 0 || now - lastClockSample > clockSampleInterval * 1e6) {
+			uint32_t cycleTime;
+			uint64_t systemTime;
+			if(dc1394_read_cycle_timer(camera, &cycleTime, &systemTime) == DC1394_SUCCESS) {
+				clockModel.addSample(cycleTime, systemTime);
+			}
+			clockShutter = getShutterAbs();
+			lastClockSample = now;
+		}
+		uint64_t transfer = frame->packets_per_frame * 125;
+		uint64_t exposure = transfer + (uint64_t) (clockShutter * 1e6);
+		uint64_t received = clockModel.systemToSteady(frame->timestamp);
+		metadata.exposureStart = received > exposure ? received - exposure : 0;
+	}
+	
+	const FrameMetadata& Camera::getFrameMetadata() const {
+		return metadata;
+	}
+	
+	void Camera::setAutoExposure(AutoExposure* autoExposure) {
+		if(this->autoExposure)
+			this->autoExposure->stop();
+		this->autoExposure = autoExposure;
+		if(autoExposure) {
+			if(camera) {
+				if(!autoExposure->start(*this))
+					this->autoExposure = NULL;
+			} else
+				ofLogWarning() << "Call setAutoExposure() after setup().";
+		}
+	}
+	
+	// called after the frame is back in the ring, so changes land between frames
+	void Camera::updateAutoExposure() {
+		if(autoExposure && camera) {
+			// only gray and RGB frames are measured, don't feed the controller stale statistics
+			if(metadata.statistics == NULL) {
+				if(!autoExposureWarned) {
+					ofLogWarning() << "Auto exposure is paused, frames in pixel format " << getOutputFormat() << " aren't measured.";
+					autoExposureWarned = true;
+				}
+				return;
+			}
+			autoExposure->addStatistics(statistics);
+			float shutter, gain;
+			if(autoExposure->getUpdate(shutter, gain)) {
+				dc1394_feature_set_absolute_value(camera, DC1394_FEATURE_SHUTTER, shutter);
+				dc1394_feature_set_absolute_value(camera, DC1394_FEATURE_GAIN, gain);
+			}
+		}
+	}
+	
+	unsigned int Camera::getChannels() const {
+		return imageType == OF_IMAGE_GRAYSCALE ? 1 : 3;
+	}
+	
+	void Camera::setBufferSize(unsigned int bufferSize) {
+		if(bufferSize != this->bufferSize) {
+			this->bufferSize = bufferSize;
+			if(camera && applied.capturing) {
+				dc1394_capture_stop(camera);
+				dc1394_capture_setup(camera, bufferSize, DC1394_CAPTURE_FLAGS_DEFAULT);
+				applied.bufferSize = bufferSize;
+			}
+		}
+	}
+	
+	void Camera::allocateBurst(unsigned int frames) {
+		ofPixelFormat format = getOutputFormat();
+		size_t frameBytes = ofPixels::bytesFromPixelFormat(width, height, format);
+		if(burstArena.size() < frames * frameBytes) {
+			burstArena.resize(frames * frameBytes);
+		}
+		burstFrames.resize(frames);
+		for(unsigned int i = 0; i < frames; i++) {
+			BurstFrame& burst = burstFrames[i];
+			burst.pixels.setFromExternalPixels(&burstArena[i * frameBytes], width, height, format);
+			burst.timestamp = 0;
+			burst.framesBehind = 0;
+			burst.left = burst.top = 0;
+			burst.exposureStart = 0;
+			burst.mosaic = false;
+			burst.colorFilter = bayerMode;
+		}
+		// every frame of the burst needs a slot in the ring, or the sensor will
+		// overrun the buffer while we are still converting
+		if(camera && frames > bufferSize) {
+			setBufferSize(frames);
+		}
+	}
+	
+	const vector<BurstFrame>& Camera::grabBurst(unsigned int frames) {
+		if(!camera || isStereoCamera() || frames == 0) {
+			ofLogError() << "grabBurst() requires a connected mono or color camera.";
+			burstFrames.clear();
+			return burstFrames;
+		}
+		
+		if(burstFrames.size() != frames || frames > bufferSize ||
+			burstFrames[0].pixels.getWidth() != width || burstFrames[0].pixels.getHeight() != height ||
+			burstFrames[0].pixels.getPixelFormat() != getOutputFormat()) {
+			allocateBurst(frames);
+		}
+		
+		// a lost frame or a camera that ignores multi-shot would otherwise
+		// block forever, so allow twice the burst's duration plus a second
+		float interval = 0;
+		if(useFormat7) {
+			dc1394_format7_get_frame_interval(camera, videoMode, &interval);
+		} else if(applied.valid) {
+			interval = 1 / makeFloat(applied.frameRate);
+		}
+		if(interval <= 0) {
+			interval = frameRate > 0 ? 1 / frameRate : 1;
+		}
+		uint64_t deadline = ofGetElapsedTimeMicros() + (uint64_t) ((2 * frames * interval + 1) * 1e6);
+		
+		placeThread();
+		setTransmit(false);
+		flushBuffer();
+		bool multiShot = camera->multi_shot_capable == DC1394_TRUE;
+		if(multiShot) {
+			dc1394_video_set_multi_shot(camera, frames, DC1394_ON);
+		} else {
+			ofLogWarning() << "Camera is not multi-shot capable, capturing a burst from continuous video.";
+			setTransmit(true);
+		}
+		
+		unsigned int captured = 0;
+		while(captured < frames && waitForFrame(deadline)) {
+			dc1394video_frame_t* frame = dequeueFrame(false, DC1394_CAPTURE_POLICY_POLL);
+			if(frame == NULL) {
+				continue;
+			}
+			BurstFrame& burst = burstFrames[captured++];
+			convertFrame(frame, burst.pixels.getData());
+			readMetadata(frame);
+			burst.timestamp = metadata.timestamp;
+			burst.framesBehind = metadata.framesBehind;
+			burst.left = metadata.left;
+			burst.top = metadata.top;
+			burst.exposureStart = metadata.exposureStart;
+			burst.mosaic = metadata.mosaic;
+			burst.colorFilter = metadata.colorFilter;
+			dc1394_capture_enqueue(camera, frame);
+			afterFrame();
+		}
+		
+		if(!multiShot) {
+			setTransmit(false);
+		}
+		if(captured < frames) {
+			// the camera may still be counting down the shots we didn't get
+			if(multiShot) {
+				dc1394_video_set_multi_shot(camera, 0, DC1394_OFF);
+			}
+			ofLogError() << "Burst stopped after " << captured << " of " << frames << " frames.";
+			burstFrames.resize(captured);
+		}
+		ready = captured > 0;
+		return burstFrames;
+	}
+	
+    bool Camera::grabFrame(ofImage& img1, ofImage& img2) {
+		return grabStereoFrame(&img1, &img2, false);
+	}
+	
+	bool Camera::grabStereoFrame(ofImage* img1, ofImage* img2, bool dropFrames) {
+		if(!camera) {
+			return false;
+		}
+		placeThread();
+		dc1394video_frame_t *frame = NULL, *next;
+		if(dropFrames) {
+			while(dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &next) == DC1394_SUCCESS && next != NULL) {
+				if(frame != NULL)
+					dc1394_capture_enqueue(camera, frame);
+				if(recorder)
+					recorder->addFrame(next, false, bayerMode);
+				frame = next;
+			}
+		} else {
+			dc1394_capture_dequeue(camera, capturePolicy, &frame);
+			if(frame != NULL && recorder)
+				recorder->addFrame(frame, false, bayerMode);
+		}
+		if(frame == NULL) {
+			return false;
+		}
+		
+		// stereo extract
+		dc1394video_frame_t frame1 = *frame;
+		frame1.allocated_image_bytes = frame->total_bytes;
+		frame1.image = (unsigned char*)malloc(frame1.allocated_image_bytes);
+		frame1.color_coding = DC1394_COLOR_CODING_RAW8;
+		if(dc1394_deinterlace_stereo_frames(frame, &frame1, stereoMethod) != DC1394_SUCCESS) {
+			free(frame1.image);
+			dc1394_capture_enqueue(camera, frame);
+			return false;
+		}
+		
+		// the deinterlaced eyes are stacked, each one still raw
+		bool matched = true;
+		if(stereoMatcher) {
+			StereoSource source = imageType == OF_IMAGE_COLOR ? STEREO_SOURCE_BAYER_GREEN : STEREO_SOURCE_GRAY;
+			matched = stereoMatcher->compute(frame1.image, frame1.image + width * height, width, height, source, bayerMode);
+		}
+		if(img1 == NULL || img2 == NULL) {
+			// only the disparity was asked for, so a failed match fails the grab
+			dc1394_capture_enqueue(camera, frame);
+			free(frame1.image);
+			ready = true;
+			return matched;
+		}
+		
+		if(img1->getWidth() != width || img1->getHeight() != height) {
+			img1->allocate(width, height, imageType);
+		}
+		if(img2->getWidth() != width || img2->getHeight() != height) {
+			img2->allocate(width, height, imageType);
+		}
+		
+		// bayer conversation
+		dc1394video_frame_t frame2;
+		frame2.allocated_image_bytes = (frame1.size[0]*frame1.size[1]*3*sizeof(unsigned char));
+		frame2.image = (unsigned char*)malloc(frame2.allocated_image_bytes);
+		frame2.color_coding = DC1394_COLOR_CODING_RGB8;
+		frame1.color_filter = bayerMode;
+		if(dc1394_debayer_frames(&frame1, &frame2, bayerMethod) != DC1394_SUCCESS) {
+			free(frame2.image);
+			free(frame1.image);
+			dc1394_capture_enqueue(camera, frame);
+			return false;
+		}
+		
+		// buffer copy
+		unsigned char* buffer = reinterpret_cast<unsigned char*>(frame2.image);
+		unsigned int size = width * height * 3;
+		memcpy(img1->getPixels().getData(), buffer, size);
+		memcpy(img2->getPixels().getData(), buffer+size, size);
+		
+		dc1394_capture_enqueue(camera, frame);
+		free(buffer);
+		free(frame1.image);
+		ready = true;
+		return true;
+	}
+	
+	void Camera::setStereoMatcher(StereoMatcher* stereoMatcher) {
+		this->stereoMatcher = stereoMatcher;
+	}
+	
+	bool Camera::grabDisparity(bool dropFrames) {
+		if(!camera || !isStereoCamera() || !stereoMatcher) {
+			return false;
+		}
+		setTransmit(true);
+		return grabStereoFrame(NULL, NULL, dropFrames && !getBlocking());
+	}
 	
 	void Camera::flushBuffer() {
 		if(camera) {
@@ -653,6 +2052,56 @@ namespace ofxLibdc {
 		}
 	}
 	
+	void Camera::setPlacement(const ThreadPlacement& placement) {
+		lock_guard<mutex> guard(placementLock);
+		this->placement = placement;
+		usePlacement = true;
+		// applied again by the next thread that grabs
+		placedThread = thread::id();
+	}
+	
+	void Camera::clearPlacement() {
+		lock_guard<mutex> guard(placementLock);
+		usePlacement = false;
+		placedThread = thread::id();
+		placementReport = PlacementReport();
+	}
+	
+	PlacementReport Camera::getPlacementReport() const {
+		lock_guard<mutex> guard(placementLock);
+		return placementReport;
+	}
+	
+	void Camera::placeThread() {
+		unique_lock<mutex> guard(placementLock);
+		if(!usePlacement || placedThread == this_thread::get_id()) {
+			return;
+		}
+		placementReport = applyPlacement(placement);
+		placedThread = this_thread::get_id();
+		bool relocate = placementReport.numaNode >= 0;
+		guard.unlock();
+		if(relocate) {
+			// reallocate from the pinned thread, so first touch puts the pages on its node
+			relocateBuffers = true;
+			framePool.relocate();
+			if(!burstFrames.empty()) {
+				unsigned int frames = burstFrames.size();
+				vector<unsigned char>().swap(burstArena);
+				allocateBurst(frames);
+			}
+		}
+	}
+	
+	bool Camera::setRecorder(CompressedRecorder* recorder) {
+		if(recorder != NULL && applied.valid && !CompressedRecorder::isSupported(applied.colorCoding)) {
+			ofLogError() << "Can't record frames coded as " << makeString(applied.colorCoding) << ".";
+			return false;
+		}
+		this->recorder = recorder;
+		return true;
+	}
+	
 	dc1394camera_t* Camera::getLibdcCamera() {
 		return camera;
 	}
@@ -662,7 +2111,9 @@ namespace ofxLibdc {
 	}
 	
 	unsigned int Camera::getSourceDepth() const {
-		if(useBayer) {
+		if(rawBayer) {
+			return rawDepth / 8;
+		} else if(useBayer) {
 			return 3;
 		} else {
 			return 1;
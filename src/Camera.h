@@ -2,6 +2,16 @@
 
 #include "ofMain.h"
 #include "dc1394.h"
+#include "Capabilities.h"
+#include "Statistics.h"
+#include "ClockModel.h"
+#include "Stereo.h"
+#include "Conversion.h"
+#include "AutoExposure.h"
+#include "Placement.h"
+#include "FramePool.h"
+#include "Subscription.h"
+#include "Coroutine.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,6 +21,46 @@
 
 namespace ofxLibdc {
 
+class CompressedRecorder;
+class Camera;
+
+// per-phase timing from Camera::setupAll(), in seconds
+struct StartupTiming {
+	float enumerate, reset, open, configure, total;
+	vector<float> configurePerCamera;
+};
+
+// a feature value requested with setFeatureRaw() or setFeatureAbs()
+struct FeatureSetting {
+	dc1394feature_t feature;
+	bool absolute;
+	float value;
+};
+
+// describes the most recently grabbed frame
+struct FrameMetadata {
+	uint64_t timestamp; // host time in microseconds when the frame was received
+	unsigned int framesBehind; // frames still waiting in the DMA buffer
+	const FrameStatistics* statistics; // NULL unless statistics are enabled
+	unsigned int left, top; // Format7 ROI position the frame was captured with
+	bool positionVerified; // true if the position was embedded in the frame itself
+	uint64_t exposureStart; // microseconds on steady_clock, 0 unless setClockModel() is on
+	bool exposureStartEmbedded; // true if it comes from a timestamp embedded in the frame
+	bool mosaic; // true if the pixels are the raw Bayer samples
+	dc1394color_filter_t colorFilter; // the tile of the mosaic, see demosaic() in Conversion.h
+};
+
+// a frame from grabBurst(), pointing into memory owned by the Camera
+struct BurstFrame {
+	ofPixels pixels;
+	uint64_t timestamp; // host time in microseconds when the frame was received
+	unsigned int framesBehind;
+	unsigned int left, top;
+	uint64_t exposureStart; // steady_clock microseconds, see ClockModel.h
+	bool mosaic; // raw Bayer samples, see Camera::setRawBayer()
+	dc1394color_filter_t colorFilter;
+};
+
 class Camera {
 public:
 	Camera(bool isStereoCamera = false);
@@ -24,22 +74,64 @@ public:
 	void set1394b(bool use1394b);
 	void setBlocking(bool blocking);
 	void setBayerMode(dc1394color_filter_t bayerMode);
+	// delivers the mosaic untouched as single channel pixels instead of
+	// demosaicing, see getFrameMetadata().colorFilter. 16-bit frames are read
+	// with grabRaw(), and grabVideo() gives their high bytes.
+	void setRawBayer(dc1394color_filter_t bayerMode, unsigned int bitDepth = 8);
 	void setFrameRate(float frameRate);
+	// Format7 bytes per packet, 0 to derive it from the framerate
+	void setPacketSize(unsigned int packetSize);
+	// load this memory channel during setup, -1 for none. Raw and absolute
+	// feature values set before setup are then only written if they differ.
+	void setMemoryChannel(int memoryChannel);
 	
 	ofImageType getImageType() const;
+	bool getRawBayer() const;
+	dc1394color_filter_t getBayerMode() const;
 	bool getBlocking() const;
 	unsigned int getWidth() const;
 	unsigned int getHeight() const;
 	float getFrameRate() const;
+	unsigned int getPacketSize() const;
+	
+	// the output format, negotiated against the camera's color codings so
+	// frames need the least conversion. OF_PIXELS_UNKNOWN follows the image
+	// type. A connected camera is reconfigured, and false means no coding can
+	// produce the format. setImageType() clears it. The conversion path is
+	// only known once the format has been negotiated during setup().
+	bool setPixelFormat(ofPixelFormat pixelFormat);
+	ofPixelFormat getPixelFormat() const;
+	ConversionPath getConversionPath() const;
     
     // stereo camera settings
     void setStereoCamera(bool isStereo);
     bool isStereoCamera() const;
 	
+	// trigger settings, these can be changed before or after setup
+	void setTrigger(bool useTrigger);
+	void setTriggerMode(dc1394trigger_mode_t triggerMode);
+	void setTriggerSource(dc1394trigger_source_t triggerSource);
+	void setTriggerPolarity(dc1394trigger_polarity_t triggerPolarity);
+	void setTriggerDelay(float triggerDelay); // in seconds
+	
+	bool getTrigger() const;
+	dc1394trigger_mode_t getTriggerMode() const;
+	dc1394trigger_source_t getTriggerSource() const;
+	dc1394trigger_polarity_t getTriggerPolarity() const;
+	float getTriggerDelay() const;
+	
 	virtual bool setup(int cameraNumber = 0);
 	virtual bool setup(string cameraGuid);
 	virtual ~Camera();
 	
+	// setupAll() brings up many cameras at once. The bus is enumerated once and
+	// reset at most once, then every camera is configured on its own thread.
+	// If guids is empty, cameras are assigned in enumeration order.
+	static bool setupAll(const vector<Camera*>& cameras, const vector<string>& guids = vector<string>(), StartupTiming* timing = NULL);
+	
+	// cache capability queries in this directory, empty to disable caching
+	static void setCapabilityCache(string directory);
+	
 	// post-setup settings	
 	
 	// normalized values
@@ -108,23 +200,124 @@ public:
 	
 	void printFeatures() const;
 	
+	// memory channels store the current settings on the camera itself, so they
+	// can be restored with one command. Channel 0 holds the factory defaults.
+	int getMemoryChannelCount() const;
+	bool saveMemoryChannel(int channel);
+	bool loadMemoryChannel(int channel);
+	const vector<FeatureSetting>& getFeatureSettings() const;
+	
 	// image grabbing
 	
 	bool grabStill(ofImage& img);
     bool grabStill(ofImage& img1, ofImage& img2);
 	bool grabVideo(ofImage& img, bool dropFrames = true);
+	// converts into a recycled buffer from getFramePool(), see FramePool.h.
+	// when dropping frames, only the newest waiting frame is converted.
+	bool grabVideo(FrameHandle& frame, bool dropFrames = true);
+	FramePool& getFramePool();
+	
+	// waits up to timeout seconds for a frame without spinning, and returns
+	// false if none arrived. waitForFrame() sleeps until a frame is ready to be
+	// grabbed or the deadline passes, in ofGetElapsedTimeMicros() time.
+	// both wait forever with a negative timeout or a deadline of 0.
+	bool grabVideoFor(ofImage& img, float timeout, bool dropFrames = true);
+	bool grabVideoFor(FrameHandle& frame, float timeout, bool dropFrames = true);
+	bool waitForFrame(uint64_t deadline = 0);
+	// 16-bit raw Bayer frames, see setRawBayer()
+	bool grabRaw(ofShortPixels& pixels, bool dropFrames = true);
+	
+	// shares the stream between consumers at different rates, see Subscription.h
+	shared_ptr<Subscription> subscribe(float frameRate = 0, FrameCallback callback = FrameCallback());
+	// grabs every waiting frame, converting only the ones a subscriber is due
+	// for. returns the number of frames that were converted.
+	unsigned int updateSubscribers();
+#ifdef OFXLIBDC_COROUTINES
+	// co_await camera.nextFrame() suspends without a thread, see Coroutine.h.
+	// the timed version resumes with an empty handle after timeout seconds.
+	FrameAwaitable nextFrame(Executor executor = Executor());
+	FrameAwaitable nextFrame(float timeout, Executor executor = Executor());
+#endif
     bool grabVideo(ofImage& img1, ofImage& img2, bool dropFrames = true);
 	
+	// armTrigger() enables the trigger and starts transmission once, so every
+	// trigger() is followed by a frame without restarting or flushing.
+	// waitFrame() blocks until the triggered frame arrives, and returns false
+	// if it doesn't within timeout seconds. a negative timeout waits forever.
+	bool armTrigger();
+	bool trigger();
+	bool waitFrame(ofImage& img, float timeout = 1);
+	bool isTriggerArmed() const;
+	
+	// grabBurst() captures frames back to back using the camera's multi-shot
+	// mode, into one contiguous arena. The returned views stay valid until the
+	// next burst. allocateBurst() can be called ahead of time so that nothing
+	// is allocated when the burst is requested. A burst that stalls returns
+	// the frames captured so far.
+	void allocateBurst(unsigned int frames);
+	const vector<BurstFrame>& grabBurst(unsigned int frames);
+	
 	void flushBuffer();
 	
+	// raw frames are handed to the recorder before conversion, NULL to stop.
+	// false if the camera is sending a coding that can't be recorded.
+	bool setRecorder(CompressedRecorder* recorder);
+	
+	// exposure statistics are gathered during conversion, NULL to stop
+	void setAutoExposure(AutoExposure* autoExposure);
+	
+	// stereo frames are also handed to the matcher, NULL to stop. see Stereo.h.
+	// grabDisparity() only computes the disparity, without converting color.
+	void setStereoMatcher(StereoMatcher* stereoMatcher);
+	bool grabDisparity(bool dropFrames = true);
+	
+	// compute FrameStatistics during conversion, with an optional tile grid
+	void setStatistics(bool useStatistics, unsigned int tileColumns = 0, unsigned int tileRows = 0);
+	const FrameMetadata& getFrameMetadata() const;
+	
+	// correlates the bus cycle time with the host clock, sampling it every
+	// sampleInterval seconds, so frames get an exposureStart in steady_clock
+	// time that can be compared between cameras. see ClockModel.h.
+	void setClockModel(bool useClockModel, float sampleInterval = .25);
+	const ClockModel& getClockModel() const;
+	
 	dc1394camera_t* getLibdcCamera();
 	bool isReady() const;
+	
+	// how long the last setup or settings change took, in seconds
+	float getReconfigurationTime() const;
+	
+	// searches the valid Format7 packet sizes for the highest framerate that
+	// is measured to be stable, or the one closest to targetFrameRate. The
+	// chosen size is kept for later reconfigurations. Returns the measured
+	// framerate, or 0 if the camera isn't running in Format7.
+	float tunePacketSize(float targetFrameRate = 0, unsigned int framesPerStep = 30);
+	
+	// pins the thread that grabs frames, see Placement.h
+	void setPlacement(const ThreadPlacement& placement);
+	void clearPlacement();
+	PlacementReport getPlacementReport() const;
 
 protected:
-	static dc1394_t* libdcContext;
-	static int libdcCameras;
-	static void startLibdcContext();
-	static void stopLibdcContext();
+	// every camera holds a reference to one shared libdc1394 context, which
+	// is freed when the last reference goes away
+	static mutex libdcLock;
+	static weak_ptr<dc1394_t> sharedLibdcContext;
+	static shared_ptr<dc1394_t> getLibdcContext();
+	shared_ptr<dc1394_t> libdcContext;
+	// libdc1394 rebuilds the context's device list in enumerate and
+	// camera_new, so those and camera_free are serialized
+	static mutex contextLock;
+	
+	// concurrent enumerations wait for the one in progress and share its result
+	static mutex enumerationLock;
+	static condition_variable enumerationDone;
+	static bool enumerating, enumerationSuccess;
+	static unsigned int enumerationGeneration;
+	static vector<uint64_t> enumeratedGuids;
+	static bool enumerateCameras(vector<uint64_t>& guids);
+	
+	static string capabilityCache;
     
     bool isStereo;
     dc1394stereo_method_t stereoMethod;
@@ -135,24 +328,122 @@ protected:
 	static dc1394color_coding_t getLibdcType(ofImageType imageType);
 		
 	dc1394camera_t* camera;
+	mutable Capabilities capabilities;
+	void saveCapabilities();
 	dc1394video_mode_t videoMode;
 	dc1394capture_policy_t capturePolicy;
 	unsigned int width, height, left, top;
 	ofImageType imageType;
+	ofPixelFormat pixelFormat;
+	ofPixelFormat getOutputFormat() const;
+	bool negotiateCoding(dc1394color_coding_t& coding);
 	float frameRate;
 	
 	bool useBayer;
 	dc1394color_filter_t bayerMode;
+	bool rawBayer;
+	unsigned int rawDepth;
 	
 	bool useFormat7;
 	int format7Mode;
 	bool use1394b;
 	bool ready;
 	
+	int memoryChannel;
+	vector<FeatureSetting> featureSettings;
+	void rememberFeature(dc1394feature_t feature, bool absolute, float value);
+	void applyFeatureSettings();
+	bool waitForMemory();
+	
+	bool useTrigger, triggerArmed;
+	dc1394trigger_mode_t triggerMode;
+	dc1394trigger_source_t triggerSource;
+	dc1394trigger_polarity_t triggerPolarity;
+	float triggerDelay;
+	
+	CompressedRecorder* recorder;
+	
+	AutoExposure* autoExposure;
+	bool autoExposureWarned; // frames in the current format can't be measured
+	void updateAutoExposure();
+	
+	bool useStatistics;
+	unsigned int tileColumns, tileRows;
+	FrameStatistics statistics;
+	FrameMetadata metadata;
+	
+	bool useClockModel;
+	float clockSampleInterval;
+	uint64_t lastClockSample;
+	float clockShutter; // seconds, refreshed with every clock sample
+	ClockModel clockModel;
+	void updateClockModel(dc1394video_frame_t* frame);
+	void updateFrameMetadata(dc1394video_frame_t* frame);
+	
+	// what is currently programmed into the camera, so that applySettings()
+	// only writes the registers that changed
+	struct CameraState {
+		bool valid, capturing, use1394b;
+		dc1394video_mode_t videoMode;
+		dc1394color_coding_t colorCoding;
+		dc1394framerate_t frameRate;
+		unsigned int packetSize, left, top, width, height, bufferSize;
+		uint64_t frameBytes;
+		uint32_t packetBytes;
+	};
+	CameraState applied;
+	float reconfigurationTime;
+	unsigned int packetSize;
+	
+	float getFrameInterval(unsigned int packetSize, unsigned int frames);
+	bool measureFrameInterval(unsigned int frames, float& interval, float& jitter);
+	
+	unsigned int bufferSize;
+	vector<unsigned char> burstArena;
+	vector<BurstFrame> burstFrames;
+	void setBufferSize(unsigned int bufferSize);
+	
 	bool grabFrame(ofImage& img);
+	bool grabFrame(ofImage& img, dc1394capture_policy_t policy);
     bool grabFrame(ofImage& img1, ofImage& img2);
-	bool initCamera(uint64_t cameraGuid);
+	// either image can be NULL to skip the color conversion
+	bool grabStereoFrame(ofImage* img1, ofImage* img2, bool dropFrames);
+	StereoMatcher* stereoMatcher;
+	void convertFrame(dc1394video_frame_t* frame, unsigned char* dst);
+	// looked up whenever the coding or output changes, see Conversion.h
+	ConversionKernel conversionKernel;
+	ConversionPath conversionPath;
+	void selectConversion();
+	FramePool framePool;
+	bool grabFrame(FrameHandle& handle, bool dropFrames);
+	bool grabFrame(FrameHandle& handle, bool dropFrames, dc1394capture_policy_t policy);
+	// with dropFrames, the newest waiting frame or NULL. the caller enqueues it.
+	dc1394video_frame_t* dequeueFrame(bool dropFrames, dc1394capture_policy_t policy);
+	
+	mutex subscriptionLock;
+	vector<weak_ptr<Subscription> > subscriptions;
+	uint64_t lastFrameTimestamp;
+	
+	bool usePlacement, relocateBuffers;
+	ThreadPlacement placement;
+	PlacementReport placementReport;
+	thread::id placedThread;
+	mutable mutex placementLock; // placeThread() runs on the capture thread
+	void placeThread();
+	
+	// subclasses that set processRows get every converted row passed to
+	// processRow() inside the conversion pass
+	bool processRows;
+	virtual void processRow(unsigned char* row, unsigned int y);
+	// called for every grabbed frame before it goes back to the ring
+	virtual void readMetadata(dc1394video_frame_t* frame);
+	// called after the frame is back in the ring, while the next one is exposing
+	virtual void afterFrame();
+	unsigned int getChannels() const;
+	bool initCamera(uint64_t cameraGuid, bool resetBus = true);
+	static uint64_t parseGuid(string cameraGuid);
 	bool applySettings();
+	void applyTrigger();
 	
 	void quantizeSize();
 	void quantizePosition();
@@ -0,0 +1,296 @@
+#include "Capabilities.h"
+#include <iomanip>
+
+namespace ofxLibdc {
+
+#define OFXLIBDC_CAPABILITIES_VERSION 1
+
+#define PTGREY_VENDOR_ID 0xb09d
+#define PTGREY_FIRMWARE_VERSION 0x1f60
+
+// the absolute range of these depends on the mode and framerate, so it's
+// read from the camera every time instead of being cached
+static bool isModeDependent(int feature) {
+	return feature == DC1394_FEATURE_SHUTTER || feature == DC1394_FEATURE_FRAME_RATE;
+}
+
+Capabilities::Capabilities() :
+camera(NULL) {
+	clear();
+}
+
+void Capabilities::clear() {
+	dirty = false;
+	videoModesLoaded = false;
+	videoModes.clear();
+	format7Loaded = false;
+	for(int i = 0; i < DC1394_VIDEO_MODE_FORMAT7_NUM; i++) {
+		Format7Info& info = format7[i];
+		info.present = false;
+		info.maxWidth = info.maxHeight = 0;
+		info.unitWidth = info.unitHeight = 0;
+		info.unitLeft = info.unitTop = 0;
+		info.colorCodings.clear();
+	}
+	features.clear();
+}
+
+void Capabilities::setCamera(dc1394camera_t* camera) {
+	this->camera = camera;
+	key = camera ? makeKey(camera) : "";
+	clear();
+}
+
+// the unit software version in the config ROM is the IIDC revision, not the
+// firmware, so the firmware revision is read from a vendor register where
+// one is known, and is 0 otherwise
+static uint32_t getFirmwareVersion(dc1394camera_t* camera) {
+	uint32_t version;
+	if(camera->vendor_id == PTGREY_VENDOR_ID &&
+		dc1394_get_control_register(camera, PTGREY_FIRMWARE_VERSION, &version) == DC1394_SUCCESS) {
+		return version;
+	}
+	return 0;
+}
+
+string Capabilities::makeKey(dc1394camera_t* camera) {
+	ostringstream key;
+	key << hex << setfill('0') <<
+		setw(16) << camera->guid << "-" <<
+		setw(6) << camera->vendor_id << "-" <<
+		setw(6) << camera->model_id << "-" <<
+		setw(6) << camera->unit_sw_version << "-" <<
+		setw(6) << camera->unit_sub_sw_version << "-" <<
+		setw(8) << getFirmwareVersion(camera);
+	return key.str();
+}
+
+const string& Capabilities::getKey() const {
+	return key;
+}
+
+bool Capabilities::isDirty() const {
+	return dirty;
+}
+
+bool Capabilities::load(string filename) {
+	ifstream file(filename.c_str());
+	if(!file.is_open()) {
+		return false;
+	}
+
+	string line, type;
+	int version;
+	if(!getline(file, line) || !(istringstream(line) >> type >> version) ||
+		type != "ofxLibdc" || version != OFXLIBDC_CAPABILITIES_VERSION) {
+		ofLogWarning() << "Ignoring capability cache " << filename << " with unknown version.";
+		return false;
+	}
+	string fileKey;
+	if(!getline(file, line) || !(istringstream(line) >> type >> fileKey) || type != "key" || fileKey != key) {
+		ofLogWarning() << "Ignoring capability cache " << filename << " for a different camera or firmware.";
+		return false;
+	}
+
+	clear();
+	while(getline(file, line)) {
+		istringstream ss(line);
+		ss >> type;
+		if(type == "modes") {
+			videoModesLoaded = true;
+		} else if(type == "mode") {
+			VideoModeInfo info;
+			int mode, colorCoding, count;
+			ss >> mode >> info.width >> info.height >> colorCoding >> count;
+			info.mode = (dc1394video_mode_t) mode;
+			info.colorCoding = (dc1394color_coding_t) colorCoding;
+			for(int i = 0; i < count; i++) {
+				int frameRate;
+				ss >> frameRate;
+				info.frameRates.push_back((dc1394framerate_t) frameRate);
+			}
+			videoModes.push_back(info);
+		} else if(type == "format7") {
+			format7Loaded = true;
+		} else if(type == "format7mode") {
+			int i, count;
+			ss >> i;
+			if(i < 0 || i >= DC1394_VIDEO_MODE_FORMAT7_NUM)
+				continue;
+			Format7Info& info = format7[i];
+			info.present = true;
+			ss >> info.maxWidth >> info.maxHeight >> info.unitWidth >> info.unitHeight >> info.unitLeft >> info.unitTop >> count;
+			for(int j = 0; j < count; j++) {
+				int colorCoding;
+				ss >> colorCoding;
+				info.colorCodings.push_back((dc1394color_coding_t) colorCoding);
+			}
+		} else if(type == "feature") {
+			int feature, hasRaw, hasAbs;
+			FeatureInfo info;
+			ss >> feature >> hasRaw >> info.min >> info.max >> hasAbs >> info.absMin >> info.absMax;
+			info.hasRaw = hasRaw;
+			info.hasAbs = hasAbs && !isModeDependent(feature);
+			features[feature] = info;
+		}
+		if(ss.fail()) {
+			ofLogWarning() << "Ignoring corrupt capability cache " << filename << ".";
+			clear();
+			return false;
+		}
+	}
+	ofLogVerbose() << "Loaded capabilities from " << filename;
+	return true;
+}
+
+bool Capabilities::save(string filename) {
+	ofstream file(filename.c_str());
+	if(!file.is_open()) {
+		ofLogWarning() << "Couldn't write capability cache " << filename << ".";
+		return false;
+	}
+	file << "ofxLibdc " << OFXLIBDC_CAPABILITIES_VERSION << endl;
+	file << "key " << key << endl;
+	if(videoModesLoaded) {
+		file << "modes" << endl;
+		for(unsigned int i = 0; i < videoModes.size(); i++) {
+			const VideoModeInfo& info = videoModes[i];
+			file << "mode " << info.mode << " " << info.width << " " << info.height << " " << info.colorCoding << " " << info.frameRates.size();
+			for(unsigned int j = 0; j < info.frameRates.size(); j++)
+				file << " " << info.frameRates[j];
+			file << endl;
+		}
+	}
+	if(format7Loaded) {
+		file << "format7" << endl;
+		for(int i = 0; i < DC1394_VIDEO_MODE_FORMAT7_NUM; i++) {
+			const Format7Info& info = format7[i];
+			if(info.present) {
+				file << "format7mode " << i << " " << info.maxWidth << " " << info.maxHeight << " " <<
+					info.unitWidth << " " << info.unitHeight << " " << info.unitLeft << " " << info.unitTop << " " <<
+					info.colorCodings.size();
+				for(unsigned int j = 0; j < info.colorCodings.size(); j++)
+					file << " " << info.colorCodings[j];
+				file << endl;
+			}
+		}
+	}
+	file << setprecision(9);
+	for(map<int, FeatureInfo>::iterator it = features.begin(); it != features.end(); it++) {
+		const FeatureInfo& info = it->second;
+		bool hasAbs = info.hasAbs && !isModeDependent(it->first);
+		file << "feature " << it->first << " " << info.hasRaw << " " << info.min << " " << info.max << " " <<
+			hasAbs << " " << (hasAbs ? info.absMin : 0) << " " << (hasAbs ? info.absMax : 0) << endl;
+	}
+	dirty = false;
+	ofLogVerbose() << "Saved capabilities to " << filename;
+	return true;
+}
+
+void Capabilities::queryVideoModes() {
+	videoModes.clear();
+	dc1394video_modes_t modes;
+	if(camera && dc1394_video_get_supported_modes(camera, &modes) == DC1394_SUCCESS) {
+		for(unsigned int i = 0; i < modes.num; i++) {
+			if(dc1394_is_video_mode_scalable(modes.modes[i]))
+				continue;
+			VideoModeInfo info;
+			info.mode = modes.modes[i];
+			dc1394_get_image_size_from_video_mode(camera, info.mode, &info.width, &info.height);
+			dc1394_get_color_coding_from_video_mode(camera, info.mode, &info.colorCoding);
+			dc1394framerates_t frameRates;
+			if(dc1394_video_get_supported_framerates(camera, info.mode, &frameRates) == DC1394_SUCCESS) {
+				info.frameRates.assign(frameRates.framerates, frameRates.framerates + frameRates.num);
+			}
+			videoModes.push_back(info);
+		}
+		// a failed query is retried next time instead of being cached
+		videoModesLoaded = true;
+		dirty = true;
+	}
+}
+
+void Capabilities::queryFormat7() {
+	dc1394format7modeset_t modeset;
+	if(camera && dc1394_format7_get_modeset(camera, &modeset) == DC1394_SUCCESS) {
+		for(int i = 0; i < DC1394_VIDEO_MODE_FORMAT7_NUM; i++) {
+			const dc1394format7mode_t& mode = modeset.mode[i];
+			Format7Info& info = format7[i];
+			info.present = mode.present == DC1394_TRUE;
+			info.maxWidth = mode.max_size_x;
+			info.maxHeight = mode.max_size_y;
+			info.unitWidth = mode.unit_size_x;
+			info.unitHeight = mode.unit_size_y;
+			info.unitLeft = mode.unit_pos_x;
+			info.unitTop = mode.unit_pos_y;
+			info.colorCodings.assign(mode.color_codings.codings, mode.color_codings.codings + mode.color_codings.num);
+		}
+		format7Loaded = true;
+		dirty = true;
+	}
+}
+
+const vector<VideoModeInfo>& Capabilities::getVideoModes() {
+	if(!videoModesLoaded)
+		queryVideoModes();
+	return videoModes;
+}
+
+const VideoModeInfo* Capabilities::getVideoMode(dc1394video_mode_t mode) {
+	const vector<VideoModeInfo>& modes = getVideoModes();
+	for(unsigned int i = 0; i < modes.size(); i++) {
+		if(modes[i].mode == mode)
+			return &modes[i];
+	}
+	return NULL;
+}
+
+const Format7Info& Capabilities::getFormat7(dc1394video_mode_t mode) {
+	if(!format7Loaded)
+		queryFormat7();
+	int i = ofClamp(mode - DC1394_VIDEO_MODE_FORMAT7_MIN, 0, DC1394_VIDEO_MODE_FORMAT7_NUM - 1);
+	return format7[i];
+}
+
+FeatureInfo& Capabilities::getFeature(dc1394feature_t feature) {
+	map<int, FeatureInfo>::iterator it = features.find(feature);
+	if(it == features.end()) {
+		FeatureInfo& info = features[feature];
+		info.hasRaw = false;
+		info.hasAbs = false;
+		info.min = info.max = 0;
+		info.absMin = info.absMax = 0;
+		return info;
+	}
+	return it->second;
+}
+
+void Capabilities::getFeatureBoundaries(dc1394feature_t feature, unsigned int* min, unsigned int* max) {
+	FeatureInfo& info = getFeature(feature);
+	if(!info.hasRaw && camera) {
+		if(dc1394_feature_get_boundaries(camera, feature, &info.min, &info.max) == DC1394_SUCCESS) {
+			info.hasRaw = true;
+			dirty = true;
+		}
+	}
+	*min = info.min;
+	*max = info.max;
+}
+
+void Capabilities::getFeatureAbsoluteBoundaries(dc1394feature_t feature, float* min, float* max) {
+	FeatureInfo& info = getFeature(feature);
+	if(isModeDependent(feature) && camera) {
+		if(dc1394_feature_get_absolute_boundaries(camera, feature, &info.absMin, &info.absMax) != DC1394_SUCCESS) {
+			info.absMin = info.absMax = 0;
+		}
+	} else if(!info.hasAbs && camera) {
+		if(dc1394_feature_get_absolute_boundaries(camera, feature, &info.absMin, &info.absMax) == DC1394_SUCCESS) {
+			info.hasAbs = true;
+			dirty = true;
+		}
+	}
+	*min = info.absMin;
+	*max = info.absMax;
+}
+
+}
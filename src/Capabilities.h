@@ -0,0 +1,88 @@
+/*
+ ofxLibdc::Capabilities describes what a camera supports: its fixed video
+ modes and framerates, its Format7 modes, and its feature boundaries. These
+ never change for a given camera and firmware, so they can be cached on disk
+ and setup can skip nearly all of the capability register reads.
+
+ Caching is off by default. Enable it for every camera with:
+
+	ofxLibdc::Camera::setCapabilityCache(ofToDataPath("capabilities"));
+
+ Cache files are keyed by GUID, vendor and model id, and unit software
+ version, which are all read from the config ROM when the camera is opened,
+ and by the firmware revision. Only Point Grey cameras report their firmware
+ revision, in a single register read when the camera is set up; for other
+ cameras, clear the cache after a firmware update.
+ Anything that's missing from the cache is queried from the camera on demand.
+ The absolute ranges of shutter and framerate depend on the mode, so they
+ are never cached.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "dc1394.h"
+
+namespace ofxLibdc {
+
+struct VideoModeInfo {
+	dc1394video_mode_t mode;
+	unsigned int width, height;
+	dc1394color_coding_t colorCoding;
+	vector<dc1394framerate_t> frameRates;
+};
+
+struct Format7Info {
+	bool present;
+	unsigned int maxWidth, maxHeight;
+	unsigned int unitWidth, unitHeight;
+	unsigned int unitLeft, unitTop;
+	vector<dc1394color_coding_t> colorCodings;
+};
+
+struct FeatureInfo {
+	bool hasRaw, hasAbs;
+	unsigned int min, max;
+	float absMin, absMax;
+};
+
+class Capabilities {
+public:
+	Capabilities();
+
+	void setCamera(dc1394camera_t* camera);
+	// identifies the camera and its firmware, used to name cache files
+	const string& getKey() const;
+
+	bool load(string filename);
+	bool save(string filename);
+	// true if anything was queried from the camera since the last load() or save()
+	bool isDirty() const;
+
+	const vector<VideoModeInfo>& getVideoModes();
+	const VideoModeInfo* getVideoMode(dc1394video_mode_t mode);
+	const Format7Info& getFormat7(dc1394video_mode_t mode);
+	void getFeatureBoundaries(dc1394feature_t feature, unsigned int* min, unsigned int* max);
+	void getFeatureAbsoluteBoundaries(dc1394feature_t feature, float* min, float* max);
+
+protected:
+	dc1394camera_t* camera;
+	string key;
+	bool dirty;
+
+	bool videoModesLoaded;
+	vector<VideoModeInfo> videoModes;
+
+	bool format7Loaded;
+	Format7Info format7[DC1394_VIDEO_MODE_FORMAT7_NUM];
+
+	map<int, FeatureInfo> features;
+	FeatureInfo& getFeature(dc1394feature_t feature);
+
+	static string makeKey(dc1394camera_t* camera);
+	void clear();
+	void queryVideoModes();
+	void queryFormat7();
+};
+
+}
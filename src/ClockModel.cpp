@@ -0,0 +1,142 @@
+#include "ClockModel.h"
+
+namespace ofxLibdc {
+
+// 8000 cycles per second of 3072 ticks each, and 128 seconds before wrapping
+#define OFXLIBDC_TICKS_PER_CYCLE 3072
+#define OFXLIBDC_CYCLES_PER_SECOND 8000
+#define OFXLIBDC_TICKS_PER_SECOND ((int64_t) OFXLIBDC_TICKS_PER_CYCLE * OFXLIBDC_CYCLES_PER_SECOND)
+#define OFXLIBDC_TICKS_PER_WRAP (128 * OFXLIBDC_TICKS_PER_SECOND)
+
+ClockModel::ClockModel(unsigned int window) :
+window(max(window, 2u)) {
+	clear();
+}
+
+void ClockModel::clear() {
+	lock_guard<mutex> guard(lock);
+	samples.clear();
+	lastCycleTime = 0;
+	lastTicks = 0;
+	steadyAtLast = 0;
+	slope = 1e6 / OFXLIBDC_TICKS_PER_SECOND;
+	residual = 0;
+	steadyOffset = 0;
+}
+
+void ClockModel::addSample(uint32_t cycleTime, uint64_t systemTime) {
+	// measure the system to steady offset as close to the sample as possible
+	int64_t offset = (int64_t) getSteadyTime() - (int64_t) getSystemTime();
+	lock_guard<mutex> guard(lock);
+	steadyOffset = offset;
+	if(samples.empty()) {
+		lastTicks = toTicks(cycleTime);
+	} else {
+		lastTicks += getTickDelta(lastCycleTime, cycleTime);
+	}
+	lastCycleTime = cycleTime;
+	Sample sample = {lastTicks, (int64_t) systemTime + offset};
+	samples.push_back(sample);
+	while(samples.size() > window) {
+		samples.pop_front();
+	}
+	fit();
+}
+
+/*
+ Fit relative to the newest sample, so the doubles only hold differences of
+ a few seconds and keep sub-microsecond precision. With one sample, or
+ samples too close together, the nominal rate is used.
+ */
+void ClockModel::fit() {
+	const Sample& last = samples.back();
+	unsigned int n = samples.size();
+	double meanX = 0, meanY = 0;
+	for(unsigned int i = 0; i < n; i++) {
+		meanX += samples[i].ticks - last.ticks;
+		meanY += samples[i].steady - last.steady;
+	}
+	meanX /= n;
+	meanY /= n;
+	double sxx = 0, sxy = 0;
+	for(unsigned int i = 0; i < n; i++) {
+		double dx = (samples[i].ticks - last.ticks) - meanX;
+		double dy = (samples[i].steady - last.steady) - meanY;
+		sxx += dx * dx;
+		sxy += dx * dy;
+	}
+	// at least a tenth of a second between the oldest and newest sample
+	double minimumSpread = OFXLIBDC_TICKS_PER_SECOND / 10.;
+	if(n > 1 && samples.front().ticks + minimumSpread < last.ticks) {
+		slope = sxy / sxx;
+	} else {
+		slope = 1e6 / OFXLIBDC_TICKS_PER_SECOND;
+	}
+	steadyAtLast = last.steady + meanY - slope * meanX;
+	double squared = 0;
+	for(unsigned int i = 0; i < n; i++) {
+		double predicted = steadyAtLast + slope * (samples[i].ticks - last.ticks);
+		double error = samples[i].steady - predicted;
+		squared += error * error;
+	}
+	residual = sqrt(squared / n);
+}
+
+bool ClockModel::isValid() const {
+	lock_guard<mutex> guard(lock);
+	return !samples.empty();
+}
+
+uint64_t ClockModel::toSteady(uint32_t cycleTime) const {
+	lock_guard<mutex> guard(lock);
+	int64_t ticks = getTickDelta(lastCycleTime, cycleTime);
+	return (uint64_t) llround(steadyAtLast + slope * ticks);
+}
+
+uint64_t ClockModel::systemToSteady(uint64_t systemTime) const {
+	lock_guard<mutex> guard(lock);
+	return systemTime + steadyOffset;
+}
+
+double ClockModel::getDrift() const {
+	lock_guard<mutex> guard(lock);
+	// slope is host time per tick, so a fast bus clock has a small slope
+	return (1e6 / (slope * OFXLIBDC_TICKS_PER_SECOND) - 1) * 1e6;
+}
+
+double ClockModel::getResidual() const {
+	lock_guard<mutex> guard(lock);
+	return residual;
+}
+
+unsigned int ClockModel::getSampleCount() const {
+	lock_guard<mutex> guard(lock);
+	return samples.size();
+}
+
+int64_t ClockModel::toTicks(uint32_t cycleTime) {
+	int64_t seconds = (cycleTime >> 25) & 0x7f;
+	int64_t cycles = (cycleTime >> 12) & 0x1fff;
+	int64_t offset = cycleTime & 0xfff;
+	return seconds * OFXLIBDC_TICKS_PER_SECOND + cycles * OFXLIBDC_TICKS_PER_CYCLE + offset;
+}
+
+int64_t ClockModel::getTickDelta(uint32_t from, uint32_t to) {
+	int64_t delta = (toTicks(to) - toTicks(from)) % OFXLIBDC_TICKS_PER_WRAP;
+	if(delta >= OFXLIBDC_TICKS_PER_WRAP / 2) {
+		delta -= OFXLIBDC_TICKS_PER_WRAP;
+	} else if(delta < -OFXLIBDC_TICKS_PER_WRAP / 2) {
+		delta += OFXLIBDC_TICKS_PER_WRAP;
+	}
+	return delta;
+}
+
+uint64_t ClockModel::getSteadyTime() {
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t ClockModel::getSystemTime() {
+	return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+ ofxLibdc::ClockModel relates a camera's 1394 bus cycle time to the host's
+ steady_clock, so frames from different cameras can be put on one timeline.
+
+	camera.setClockModel(true);
+	if(camera.grabVideo(curFrame)) {
+		uint64_t start = camera.getFrameMetadata().exposureStart; // steady_clock microseconds
+		double drift = camera.getClockModel().getDrift(); // ppm
+	}
+
+ The cycle timer counts 24.576 MHz ticks and wraps every 128 seconds. Every
+ sample pairs a cycle timer reading with the host time it was latched at,
+ from dc1394_read_cycle_timer(). Samples are unwrapped into one continuous
+ count, and a least squares line through the most recent ones estimates the
+ drift and offset between the two clocks. Cycle times embedded in frames are
+ unwrapped against the latest sample, so they can be converted as long as
+ they are within a minute of it.
+
+ Host times are reported by libdc1394 on the system clock, which can be
+ stepped. They are moved onto steady_clock with an offset measured at each
+ sample.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include <stdint.h>
+
+namespace ofxLibdc {
+
+class ClockModel {
+public:
+	// window is the number of recent samples the fit uses
+	ClockModel(unsigned int window = 64);
+
+	void clear();
+	// cycleTime and systemTime were read together, systemTime in microseconds
+	void addSample(uint32_t cycleTime, uint64_t systemTime);
+
+	// true once there is at least one sample
+	bool isValid() const;
+	// a bus cycle time in microseconds on steady_clock
+	uint64_t toSteady(uint32_t cycleTime) const;
+	// a system clock time in microseconds on steady_clock
+	uint64_t systemToSteady(uint64_t systemTime) const;
+
+	double getDrift() const; // bus clock rate relative to the host, in ppm
+	double getResidual() const; // rms error of the fit, in microseconds
+	unsigned int getSampleCount() const;
+
+	// 24.576 MHz ticks since the last wrap of the cycle timer
+	static int64_t toTicks(uint32_t cycleTime);
+	static uint64_t getSteadyTime();
+	static uint64_t getSystemTime();
+
+protected:
+	struct Sample {
+		int64_t ticks; // unwrapped
+		int64_t steady; // microseconds
+	};
+	mutable mutex lock;
+	unsigned int window;
+	deque<Sample> samples;
+	uint32_t lastCycleTime;
+	int64_t lastTicks;
+	// steady = steadyAtLast + slope * (ticks - lastTicks)
+	double steadyAtLast, slope;
+	double residual;
+	int64_t steadyOffset; // steady_clock minus system clock
+
+	void fit();
+	// the shortest signed distance between two cycle times, in ticks
+	static int64_t getTickDelta(uint32_t from, uint32_t to);
+};
+
+}
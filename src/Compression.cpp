@@ -0,0 +1,645 @@
+#include "Compression.h"
+
+namespace ofxLibdc {
+
+#define OFXLIBDC_FILE_MAGIC "OFXLIBDC"
+#define OFXLIBDC_FILE_VERSION 2
+#define OFXLIBDC_FRAME_MAGIC 0x4644434f // "OCDF"
+
+// unary prefixes longer than this are escaped and followed by the raw residual
+#define RICE_ESCAPE 24
+#define RICE_ESCAPE_BITS 18
+#define RICE_RESET 64
+
+static void put32(vector<unsigned char>& out, uint32_t x) {
+	for(int i = 0; i < 4; i++)
+		out.push_back((x >> (i * 8)) & 0xff);
+}
+
+static void put64(vector<unsigned char>& out, uint64_t x) {
+	put32(out, x & 0xffffffff);
+	put32(out, x >> 32);
+}
+
+static uint32_t get32(const unsigned char* in) {
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+static uint64_t get64(const unsigned char* in) {
+	return get32(in) | ((uint64_t) get32(in + 4) << 32);
+}
+
+// appends to space the caller reserved, which only grows for planes that
+// code larger than they are raw
+class BitWriter {
+public:
+	BitWriter(vector<unsigned char>& out) :
+	out(out), acc(0), n(0) {
+	}
+	inline void put(uint32_t value, int bits) {
+		acc = (acc << bits) | value;
+		n += bits;
+		if(n >= 32) {
+			n -= 32;
+			uint32_t word = acc >> n;
+			out.push_back(word >> 24);
+			out.push_back(word >> 16);
+			out.push_back(word >> 8);
+			out.push_back(word);
+		}
+	}
+	void flush() {
+		while(n >= 8) {
+			n -= 8;
+			out.push_back(acc >> n);
+		}
+		if(n > 0)
+			out.push_back(acc << (8 - n));
+		n = 0;
+	}
+protected:
+	vector<unsigned char>& out;
+	uint64_t acc;
+	int n;
+};
+
+class BitReader {
+public:
+	BitReader(const unsigned char* in, size_t size) :
+	in(in), size(size), pos(0), padding(0), acc(0), n(0) {
+	}
+	inline void fill() {
+		if(n <= 32 && pos + 4 <= size) {
+			acc = (acc << 32) | ((uint32_t) in[pos] << 24) | (in[pos + 1] << 16) | (in[pos + 2] << 8) | in[pos + 3];
+			pos += 4;
+			n += 32;
+		}
+		while(n <= 56) {
+			acc = (acc << 8) | (pos < size ? in[pos] : 0);
+			if(pos < size)
+				pos++;
+			else
+				padding++;
+			n += 8;
+		}
+	}
+	inline uint32_t get(int bits) {
+		if(n < bits)
+			fill();
+		n -= bits;
+		return (acc >> n) & ((1ull << bits) - 1);
+	}
+	// returns the number of zeros before the next one, or -1 if there are too many
+	inline int getUnary() {
+		if(n <= RICE_ESCAPE)
+			fill();
+		uint64_t window = n == 64 ? acc : acc << (64 - n);
+		if(window == 0)
+			return -1;
+		int zeros = __builtin_clzll(window);
+		if(zeros > RICE_ESCAPE)
+			return -1;
+		n -= zeros + 1;
+		return zeros;
+	}
+	bool valid() const {
+		return (pos + padding) * 8 - n <= size * 8;
+	}
+protected:
+	const unsigned char* in;
+	size_t size, pos, padding;
+	uint64_t acc;
+	int n;
+};
+
+static inline int readSample(const unsigned char* p, unsigned int bytesPerPixel) {
+	return bytesPerPixel == 1 ? p[0] : (p[0] << 8) | p[1];
+}
+
+static inline void writeSample(unsigned char* p, unsigned int bytesPerPixel, int x) {
+	if(bytesPerPixel == 1) {
+		p[0] = x;
+	} else {
+		p[0] = x >> 8;
+		p[1] = x & 0xff;
+	}
+}
+
+// median edge detector from LOCO-I / JPEG-LS, written as the median of
+// left, up and the planar gradient so it compiles without branches
+static inline int predict(int left, int up, int upLeft) {
+	int lo = min(left, up), hi = max(left, up);
+	return min(max(left + up - upLeft, lo), hi);
+}
+
+static inline int getBitLength(uint32_t x) {
+	return x == 0 ? 0 : 32 - __builtin_clz(x);
+}
+
+// approximately log2(sum / count), without a division per sample
+static inline int getRiceParameter(uint32_t sum, uint32_t count) {
+	int k = getBitLength(sum) - getBitLength(count);
+	return k < 0 ? 0 : k > 16 ? 16 : k;
+}
+
+void BayerCodec::encodePlane(const unsigned char* src, unsigned int stride, unsigned int step,
+	unsigned int width, unsigned int height, unsigned int bytesPerPixel, vector<unsigned char>& out) {
+	BitWriter writer(out);
+	vector<int> prev(width), cur(width);
+	uint32_t sum = 16, count = 1;
+	for(unsigned int y = 0; y < height; y++) {
+		const unsigned char* row = src + y * stride;
+		for(unsigned int x = 0; x < width; x++) {
+			int sample = readSample(row + x * step, bytesPerPixel);
+			int prediction;
+			if(y == 0) {
+				prediction = x == 0 ? 0 : cur[x - 1];
+			} else {
+				prediction = x == 0 ? prev[x] : predict(cur[x - 1], prev[x], prev[x - 1]);
+			}
+			cur[x] = sample;
+			int residual = sample - prediction;
+			uint32_t mapped = ((uint32_t) residual << 1) ^ (uint32_t) (residual >> 31);
+			int k = getRiceParameter(sum, count);
+			uint32_t quotient = mapped >> k;
+			if(quotient < RICE_ESCAPE) {
+				writer.put(1, quotient + 1);
+				writer.put(mapped & ((1 << k) - 1), k);
+			} else {
+				writer.put(1, RICE_ESCAPE + 1);
+				writer.put(mapped, RICE_ESCAPE_BITS);
+			}
+			sum += mapped;
+			if(++count == RICE_RESET) {
+				sum >>= 1;
+				count >>= 1;
+			}
+		}
+		prev.swap(cur);
+	}
+	writer.flush();
+}
+
+bool BayerCodec::decodePlane(const unsigned char* in, size_t size, unsigned char* dst, unsigned int stride, unsigned int step,
+	unsigned int width, unsigned int height, unsigned int bytesPerPixel) {
+	BitReader reader(in, size);
+	vector<int> prev(width), cur(width);
+	uint32_t sum = 16, count = 1;
+	for(unsigned int y = 0; y < height; y++) {
+		unsigned char* row = dst + y * stride;
+		for(unsigned int x = 0; x < width; x++) {
+			int k = getRiceParameter(sum, count);
+			int quotient = reader.getUnary();
+			uint32_t mapped;
+			if(quotient < 0) {
+				return false;
+			} else if(quotient < RICE_ESCAPE) {
+				mapped = (quotient << k) | reader.get(k);
+			} else {
+				mapped = reader.get(RICE_ESCAPE_BITS);
+			}
+			int residual = (mapped >> 1) ^ -(int) (mapped & 1);
+			int prediction;
+			if(y == 0) {
+				prediction = x == 0 ? 0 : cur[x - 1];
+			} else {
+				prediction = x == 0 ? prev[x] : predict(cur[x - 1], prev[x], prev[x - 1]);
+			}
+			cur[x] = prediction + residual;
+			writeSample(row + x * step, bytesPerPixel, cur[x]);
+			sum += mapped;
+			if(++count == RICE_RESET) {
+				sum >>= 1;
+				count >>= 1;
+			}
+		}
+		prev.swap(cur);
+	}
+	return reader.valid();
+}
+
+/*
+ A frame is stored as a fixed header followed by independently coded planes,
+ so the planes can be decoded in parallel:
+
+	magic, width, height, bytesPerPixel, channels, bayer, bayerMode,
+	timestamp (64 bit), planeCount, planeSize[planeCount], plane data...
+
+ Bayer frames have one plane per CFA color, other frames one per channel.
+ */
+void BayerCodec::encode(const CompressedFrame& frame, vector<unsigned char>& out) {
+	unsigned int planes = frame.bayer ? 4 : frame.channels;
+	// room for the frame stored raw, which is reused across frames and only
+	// grows if noise makes the coded planes larger
+	out.clear();
+	out.reserve(40 + planes * 12 + frame.data.size());
+	put32(out, OFXLIBDC_FRAME_MAGIC);
+	put32(out, frame.width);
+	put32(out, frame.height);
+	put32(out, frame.bytesPerPixel);
+	put32(out, frame.channels);
+	put32(out, frame.bayer ? 1 : 0);
+	put32(out, frame.bayerMode);
+	put64(out, frame.timestamp);
+
+	put32(out, planes);
+	size_t sizeOffset = out.size();
+	for(unsigned int i = 0; i < planes; i++)
+		put32(out, 0);
+
+	unsigned int pixelBytes = frame.channels * frame.bytesPerPixel;
+	unsigned int rowBytes = frame.width * pixelBytes;
+	for(unsigned int i = 0; i < planes; i++) {
+		size_t start = out.size();
+		if(frame.bayer) {
+			unsigned int dx = i % 2, dy = i / 2;
+			unsigned int planeWidth = (frame.width - dx + 1) / 2;
+			unsigned int planeHeight = (frame.height - dy + 1) / 2;
+			encodePlane(frame.data.data() + dy * rowBytes + dx * frame.bytesPerPixel, rowBytes * 2, frame.bytesPerPixel * 2,
+				planeWidth, planeHeight, frame.bytesPerPixel, out);
+		} else {
+			encodePlane(frame.data.data() + i * frame.bytesPerPixel, rowBytes, pixelBytes,
+				frame.width, frame.height, frame.bytesPerPixel, out);
+		}
+		uint32_t planeSize = out.size() - start;
+		for(int j = 0; j < 4; j++)
+			out[sizeOffset + i * 4 + j] = (planeSize >> (j * 8)) & 0xff;
+	}
+}
+
+bool BayerCodec::decode(const unsigned char* in, size_t size, CompressedFrame& frame, bool parallel) {
+	const size_t headerSize = 40;
+	if(size < headerSize || get32(in) != OFXLIBDC_FRAME_MAGIC) {
+		ofLogError() << "Compressed frame has an invalid header.";
+		return false;
+	}
+	frame.width = get32(in + 4);
+	frame.height = get32(in + 8);
+	frame.bytesPerPixel = get32(in + 12);
+	frame.channels = get32(in + 16);
+	frame.bayer = get32(in + 20) != 0;
+	frame.bayerMode = (dc1394color_filter_t) get32(in + 24);
+	frame.timestamp = get64(in + 28);
+	unsigned int planes = get32(in + 36);
+	if(frame.channels < 1 || frame.channels > 3 || (frame.bayer && frame.channels != 1) ||
+		planes != (frame.bayer ? 4u : frame.channels) || size < headerSize + planes * 4 ||
+		(frame.bytesPerPixel != 1 && frame.bytesPerPixel != 2)) {
+		ofLogError() << "Compressed frame has an invalid header.";
+		return false;
+	}
+
+	unsigned int pixelBytes = frame.channels * frame.bytesPerPixel;
+	unsigned int rowBytes = frame.width * pixelBytes;
+	frame.data.resize(rowBytes * frame.height);
+
+	vector<size_t> offsets(planes), sizes(planes);
+	size_t offset = headerSize + planes * 4;
+	for(unsigned int i = 0; i < planes; i++) {
+		sizes[i] = get32(in + headerSize + i * 4);
+		offsets[i] = offset;
+		offset += sizes[i];
+	}
+	if(offset > size) {
+		ofLogError() << "Compressed frame is truncated.";
+		return false;
+	}
+
+	vector<char> success(planes, 0);
+	auto decodeOne = [&](unsigned int i) {
+		if(frame.bayer) {
+			unsigned int dx = i % 2, dy = i / 2;
+			unsigned int planeWidth = (frame.width - dx + 1) / 2;
+			unsigned int planeHeight = (frame.height - dy + 1) / 2;
+			success[i] = decodePlane(in + offsets[i], sizes[i], frame.data.data() + dy * rowBytes + dx * frame.bytesPerPixel,
+				rowBytes * 2, frame.bytesPerPixel * 2, planeWidth, planeHeight, frame.bytesPerPixel);
+		} else {
+			success[i] = decodePlane(in + offsets[i], sizes[i], frame.data.data() + i * frame.bytesPerPixel,
+				rowBytes, pixelBytes, frame.width, frame.height, frame.bytesPerPixel);
+		}
+	};
+
+	if(parallel && planes > 1) {
+		vector<thread> threads;
+		for(unsigned int i = 1; i < planes; i++)
+			threads.push_back(thread(decodeOne, i));
+		decodeOne(0);
+		for(unsigned int i = 0; i < threads.size(); i++)
+			threads[i].join();
+	} else {
+		for(unsigned int i = 0; i < planes; i++)
+			decodeOne(i);
+	}
+
+	for(unsigned int i = 0; i < planes; i++) {
+		if(!success[i]) {
+			ofLogError() << "Compressed frame is corrupt.";
+			return false;
+		}
+	}
+	return true;
+}
+
+CompressedRecorder::CompressedRecorder() :
+nextSequence(0),
+nextWrite(0),
+copying(0),
+running(false),
+rawBytes(0),
+compressedBytes(0),
+compressMicros(0),
+startTime(0),
+framesWritten(0),
+framesDropped(0) {
+}
+
+CompressedRecorder::~CompressedRecorder() {
+	close();
+}
+
+bool CompressedRecorder::open(string filename, unsigned int threads) {
+	close();
+	file.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+	if(!file.is_open()) {
+		ofLogError() << "Couldn't open " << filename << " for recording.";
+		return false;
+	}
+	file.write(OFXLIBDC_FILE_MAGIC, 8);
+	vector<unsigned char> version;
+	put32(version, OFXLIBDC_FILE_VERSION);
+	file.write((const char*) &version[0], version.size());
+
+	for(int i = 0; i < OFXLIBDC_RECORDER_QUEUE_SIZE; i++)
+		freeJobs.push_back(new Job());
+	nextSequence = 0;
+	nextWrite = 0;
+	rawBytes = 0;
+	compressedBytes = 0;
+	compressMicros = 0;
+	framesWritten = 0;
+	framesDropped = 0;
+	startTime = ofGetElapsedTimeMicros();
+	running = true;
+
+	if(threads == 0)
+		threads = max(1u, thread::hardware_concurrency());
+	ofLogVerbose() << "Recording to " << filename << " with " << threads << " compression threads.";
+	for(unsigned int i = 0; i < threads; i++)
+		workers.push_back(thread(&CompressedRecorder::compressThread, this));
+	return true;
+}
+
+void CompressedRecorder::close() {
+	{
+		unique_lock<mutex> guard(lock);
+		if(!running)
+			return;
+		running = false;
+		// frames that are still being copied have a sequence number, so the
+		// workers have to stay until they're queued or every later frame waits
+		while(copying > 0)
+			copyFinished.wait(guard);
+	}
+	jobAvailable.notify_all();
+	for(unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+	file.close();
+
+	for(unsigned int i = 0; i < pending.size(); i++)
+		delete pending[i];
+	pending.clear();
+	map<uint64_t, Job*>::iterator it;
+	for(it = completed.begin(); it != completed.end(); it++)
+		delete it->second;
+	completed.clear();
+	for(unsigned int i = 0; i < freeJobs.size(); i++)
+		delete freeJobs[i];
+	freeJobs.clear();
+	ofLogVerbose() << "Recorded " << framesWritten << " frames, dropped " << framesDropped <<
+		", compression ratio " << getCompressionRatio() << ".";
+}
+
+bool CompressedRecorder::isOpen() const {
+	lock_guard<mutex> guard(lock);
+	return running;
+}
+
+CompressedRecorder::Job* CompressedRecorder::getFreeJob() {
+	if(freeJobs.empty())
+		return NULL;
+	Job* job = freeJobs.back();
+	freeJobs.pop_back();
+	return job;
+}
+
+bool CompressedRecorder::addFrame(const unsigned char* raw, unsigned int width, unsigned int height,
+	unsigned int bytesPerPixel, unsigned int channels, bool bayer, dc1394color_filter_t bayerMode, uint64_t timestamp) {
+	Job* job;
+	{
+		lock_guard<mutex> guard(lock);
+		if(!running)
+			return false;
+		job = getFreeJob();
+		if(job == NULL) {
+			framesDropped++;
+			return false;
+		}
+		job->sequence = nextSequence++;
+		copying++;
+	}
+
+	// the copy happens outside the lock, into a buffer that is reused across frames
+	CompressedFrame& frame = job->frame;
+	frame.width = width;
+	frame.height = height;
+	frame.bytesPerPixel = bytesPerPixel;
+	frame.channels = channels;
+	frame.bayer = bayer;
+	frame.bayerMode = bayerMode;
+	frame.timestamp = timestamp;
+	frame.data.assign(raw, raw + width * height * channels * bytesPerPixel);
+
+	{
+		lock_guard<mutex> guard(lock);
+		pending.push_back(job);
+		copying--;
+	}
+	jobAvailable.notify_one();
+	copyFinished.notify_all();
+	return true;
+}
+
+bool CompressedRecorder::addFrame(const dc1394video_frame_t* frame, bool bayer, dc1394color_filter_t bayerMode) {
+	unsigned int channels, bytesPerPixel;
+	if(!getLayout(frame->color_coding, channels, bytesPerPixel)) {
+		ofLogError() << "Can't record frames coded as " << frame->color_coding << ".";
+		lock_guard<mutex> guard(lock);
+		framesDropped++;
+		return false;
+	}
+	uint64_t frameBytes = (uint64_t) frame->size[0] * frame->size[1] * channels * bytesPerPixel;
+	if(frame->image_bytes < frameBytes) {
+		ofLogError() << "Frame has " << frame->image_bytes << " bytes, expected " << frameBytes << ".";
+		lock_guard<mutex> guard(lock);
+		framesDropped++;
+		return false;
+	}
+	// only a single channel frame can be a mosaic
+	return addFrame(frame->image, frame->size[0], frame->size[1], bytesPerPixel, channels,
+		bayer && channels == 1, bayerMode, frame->timestamp);
+}
+
+bool CompressedRecorder::isSupported(dc1394color_coding_t coding) {
+	unsigned int channels, bytesPerPixel;
+	return getLayout(coding, channels, bytesPerPixel);
+}
+
+// YUV 4:2:2 is stored as two channels, alternating chroma and luma
+bool CompressedRecorder::getLayout(dc1394color_coding_t coding, unsigned int& channels, unsigned int& bytesPerPixel) {
+	switch(coding) {
+		case DC1394_COLOR_CODING_MONO8:
+		case DC1394_COLOR_CODING_RAW8:
+			channels = 1;
+			bytesPerPixel = 1;
+			return true;
+		case DC1394_COLOR_CODING_MONO16:
+		case DC1394_COLOR_CODING_MONO16S:
+		case DC1394_COLOR_CODING_RAW16:
+			channels = 1;
+			bytesPerPixel = 2;
+			return true;
+		case DC1394_COLOR_CODING_YUV422:
+			channels = 2;
+			bytesPerPixel = 1;
+			return true;
+		case DC1394_COLOR_CODING_RGB8:
+		case DC1394_COLOR_CODING_YUV444:
+			channels = 3;
+			bytesPerPixel = 1;
+			return true;
+		case DC1394_COLOR_CODING_RGB16:
+		case DC1394_COLOR_CODING_RGB16S:
+			channels = 3;
+			bytesPerPixel = 2;
+			return true;
+		default:
+			return false;
+	}
+}
+
+void CompressedRecorder::compressThread() {
+	while(true) {
+		Job* job;
+		{
+			unique_lock<mutex> guard(lock);
+			while(pending.empty() && (running || copying > 0))
+				jobAvailable.wait(guard);
+			if(pending.empty())
+				return;
+			job = pending.front();
+			pending.pop_front();
+		}
+
+		uint64_t start = ofGetElapsedTimeMicros();
+		BayerCodec::encode(job->frame, job->encoded);
+		uint64_t elapsed = ofGetElapsedTimeMicros() - start;
+
+		{
+			lock_guard<mutex> guard(lock);
+			compressMicros += elapsed;
+			completed[job->sequence] = job;
+		}
+		writeCompleted(job);
+	}
+}
+
+// frames finish out of order, but they are always written in capture order
+void CompressedRecorder::writeCompleted(Job*) {
+	lock_guard<mutex> writeGuard(writeLock);
+	vector<Job*> ready;
+	{
+		lock_guard<mutex> guard(lock);
+		map<uint64_t, Job*>::iterator it;
+		while((it = completed.find(nextWrite)) != completed.end()) {
+			ready.push_back(it->second);
+			completed.erase(it);
+			nextWrite++;
+		}
+	}
+
+	vector<unsigned char> size;
+	for(unsigned int i = 0; i < ready.size(); i++) {
+		size.clear();
+		put32(size, ready[i]->encoded.size());
+		file.write((const char*) &size[0], size.size());
+		file.write((const char*) &ready[i]->encoded[0], ready[i]->encoded.size());
+	}
+
+	lock_guard<mutex> guard(lock);
+	for(unsigned int i = 0; i < ready.size(); i++) {
+		rawBytes += ready[i]->frame.data.size();
+		compressedBytes += ready[i]->encoded.size();
+		framesWritten++;
+		freeJobs.push_back(ready[i]);
+	}
+}
+
+float CompressedRecorder::getCompressionRatio() const {
+	lock_guard<mutex> guard(lock);
+	return compressedBytes > 0 ? (float) rawBytes / compressedBytes : 0;
+}
+
+float CompressedRecorder::getThreadThroughput() const {
+	lock_guard<mutex> guard(lock);
+	return compressMicros > 0 ? (float) rawBytes / compressMicros : 0;
+}
+
+float CompressedRecorder::getThroughput() const {
+	lock_guard<mutex> guard(lock);
+	uint64_t elapsed = ofGetElapsedTimeMicros() - startTime;
+	return elapsed > 0 ? (float) rawBytes / elapsed : 0;
+}
+
+unsigned int CompressedRecorder::getFramesWritten() const {
+	lock_guard<mutex> guard(lock);
+	return framesWritten;
+}
+
+unsigned int CompressedRecorder::getFramesDropped() const {
+	lock_guard<mutex> guard(lock);
+	return framesDropped;
+}
+
+bool CompressedPlayer::open(string filename) {
+	close();
+	file.open(filename.c_str(), ios::in | ios::binary);
+	char magic[8];
+	unsigned char version[4];
+	if(!file.is_open() ||
+		!file.read(magic, 8) || memcmp(magic, OFXLIBDC_FILE_MAGIC, 8) != 0 ||
+		!file.read((char*) version, 4) || get32(version) != OFXLIBDC_FILE_VERSION) {
+		ofLogError() << "Couldn't open " << filename << " for playback.";
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+void CompressedPlayer::close() {
+	if(file.is_open())
+		file.close();
+}
+
+bool CompressedPlayer::readFrame(CompressedFrame& frame) {
+	unsigned char size[4];
+	if(!file.is_open() || !file.read((char*) size, 4))
+		return false;
+	payload.resize(get32(size));
+	if(payload.empty() || !file.read((char*) &payload[0], payload.size())) {
+		ofLogError() << "Recording is truncated.";
+		return false;
+	}
+	return BayerCodec::decode(&payload[0], payload.size(), frame);
+}
+
+}
@@ -0,0 +1,128 @@
+/*
+ ofxLibdc::CompressedRecorder losslessly compresses raw frames on a pool of
+ worker threads and writes them to disk in capture order. Frames are handed
+ over between dequeue and enqueue, so the camera never waits on the disk.
+
+	ofxLibdc::Camera camera;
+	ofxLibdc::CompressedRecorder recorder;
+	recorder.open("capture.ofxlibdc");
+	camera.setBayerMode(DC1394_COLOR_FILTER_RGGB);
+	camera.setRecorder(&recorder);
+	camera.setup();
+
+ Bayer frames are split into their four CFA planes, so every sample is
+ predicted from neighbours of the same color. Color codings are split into
+ one plane per channel in the same way. Residuals from a median edge
+ predictor (as in LOCO-I) are entropy coded with adaptive Rice codes, which
+ is simple enough to keep up with several cameras on commodity cores.
+
+ ofxLibdc::CompressedPlayer reads the file back, decoding the planes of each
+ frame in parallel.
+
+	ofxLibdc::CompressedPlayer player;
+	player.open("capture.ofxlibdc");
+	ofxLibdc::CompressedFrame frame;
+	while(player.readFrame(frame)) {
+		// frame.data holds the original raw bytes
+	}
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "dc1394.h"
+#include <string.h>
+
+// This sets how many frames may wait for a compression thread before new
+// frames are dropped instead of stalling capture.
+#define OFXLIBDC_RECORDER_QUEUE_SIZE 32
+
+namespace ofxLibdc {
+
+struct CompressedFrame {
+	unsigned int width, height;
+	unsigned int bytesPerPixel; // 1 for 8-bit, 2 for big-endian 16-bit samples
+	unsigned int channels; // interleaved samples per pixel, 1 for mono and Bayer
+	bool bayer;
+	dc1394color_filter_t bayerMode;
+	uint64_t timestamp;
+	vector<unsigned char> data;
+};
+
+class BayerCodec {
+public:
+	static void encode(const CompressedFrame& frame, vector<unsigned char>& out);
+	static bool decode(const unsigned char* in, size_t size, CompressedFrame& frame, bool parallel = true);
+protected:
+	static void encodePlane(const unsigned char* src, unsigned int stride, unsigned int step,
+		unsigned int width, unsigned int height, unsigned int bytesPerPixel, vector<unsigned char>& out);
+	static bool decodePlane(const unsigned char* in, size_t size, unsigned char* dst, unsigned int stride, unsigned int step,
+		unsigned int width, unsigned int height, unsigned int bytesPerPixel);
+};
+
+class CompressedRecorder {
+public:
+	CompressedRecorder();
+	~CompressedRecorder();
+
+	// threads = 0 uses one compression thread per core
+	bool open(string filename, unsigned int threads = 0);
+	void close();
+	bool isOpen() const;
+
+	// copies the frame and returns immediately, false if it had to be dropped
+	bool addFrame(const unsigned char* raw, unsigned int width, unsigned int height,
+		unsigned int bytesPerPixel, unsigned int channels, bool bayer, dc1394color_filter_t bayerMode, uint64_t timestamp);
+	bool addFrame(const dc1394video_frame_t* frame, bool bayer, dc1394color_filter_t bayerMode);
+
+	// every coding but YUV 4:1:1 can be recorded, which has no whole sample per pixel
+	static bool isSupported(dc1394color_coding_t coding);
+	static bool getLayout(dc1394color_coding_t coding, unsigned int& channels, unsigned int& bytesPerPixel);
+
+	// raw bytes in divided by compressed bytes out
+	float getCompressionRatio() const;
+	// input megabytes per second of compression time on a single thread
+	float getThreadThroughput() const;
+	// input megabytes per second of wall-clock time since open()
+	float getThroughput() const;
+	unsigned int getFramesWritten() const;
+	unsigned int getFramesDropped() const;
+
+protected:
+	struct Job {
+		uint64_t sequence;
+		CompressedFrame frame;
+		vector<unsigned char> encoded;
+	};
+
+	void compressThread();
+	void writeCompleted(Job* job);
+	Job* getFreeJob();
+
+	ofstream file;
+	vector<thread> workers;
+	mutable mutex lock;
+	mutex writeLock;
+	condition_variable jobAvailable, copyFinished;
+	deque<Job*> pending;
+	vector<Job*> freeJobs;
+	map<uint64_t, Job*> completed;
+	uint64_t nextSequence, nextWrite;
+	unsigned int copying;
+	bool running;
+
+	uint64_t rawBytes, compressedBytes, compressMicros, startTime;
+	unsigned int framesWritten, framesDropped;
+};
+
+class CompressedPlayer {
+public:
+	bool open(string filename);
+	void close();
+	bool readFrame(CompressedFrame& frame);
+protected:
+	ifstream file;
+	vector<unsigned char> payload;
+};
+
+}
@@ -0,0 +1,317 @@
+#include "Conversion.h"
+#include <string.h>
+
+namespace ofxLibdc {
+
+enum {
+	RED = 0,
+	GREEN,
+	BLUE
+};
+
+static void copyRows(const unsigned char* src, unsigned char* dst, unsigned int rowBytes, unsigned int start, unsigned int end) {
+	memcpy(dst + start * rowBytes, src + start * rowBytes, (end - start) * rowBytes);
+}
+
+template <unsigned int channels>
+static void copy(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	copyRows(src, dst, width * channels, start, end);
+}
+
+static void monoToRgb(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	for(unsigned int i = start * width; i < end * width; i++) {
+		dst[3 * i] = dst[3 * i + 1] = dst[3 * i + 2] = src[i];
+	}
+}
+
+static void rgbToGray(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	for(unsigned int i = start * width; i < end * width; i++) {
+		const unsigned char* p = src + 3 * i;
+		dst[i] = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+	}
+}
+
+// reorders RGB into the layout with red at r, blue at b, and opaque alpha if there are four channels
+template <int r, int b, int channels>
+static void rgbSwizzle(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	for(unsigned int i = start * width; i < end * width; i++) {
+		const unsigned char* in = src + 3 * i;
+		unsigned char* out = dst + channels * i;
+		out[r] = in[0];
+		out[1] = in[1];
+		out[b] = in[2];
+		if(channels == 4)
+			out[3] = 255;
+	}
+}
+
+// IIDC 16-bit samples are big-endian, so the high byte comes first
+static void sixteenToGray(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	for(unsigned int i = start * width; i < end * width; i++) {
+		dst[i] = src[2 * i];
+	}
+}
+
+// IIDC YUV 4:2:2 is ordered U Y V Y
+static void yuv422ToGray(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	for(unsigned int i = start * width; i < end * width; i++) {
+		dst[i] = src[2 * i + 1];
+	}
+}
+
+static void uyvyToYuy2(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	for(unsigned int i = start * width / 2; i < end * width / 2; i++) {
+		const unsigned char* in = src + 4 * i;
+		unsigned char* out = dst + 4 * i;
+		out[0] = in[1];
+		out[1] = in[0];
+		out[2] = in[3];
+		out[3] = in[2];
+	}
+}
+
+// a full luma plane, then interleaved chroma averaged over pairs of rows
+static void uyvyToNv12(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int height, unsigned int start, unsigned int end) {
+	unsigned char* chroma = dst + width * height;
+	for(unsigned int y = start; y < end; y++) {
+		const unsigned char* row = src + 2 * width * y;
+		unsigned char* luma = dst + width * y;
+		for(unsigned int x = 0; x < width; x++)
+			luma[x] = row[2 * x + 1];
+		if(y % 2 == 0) {
+			const unsigned char* next = y + 1 < height ? row + 2 * width : row;
+			unsigned char* out = chroma + width * (y / 2);
+			for(unsigned int x = 0; x + 1 < width; x += 2) {
+				out[x] = (row[2 * x] + next[2 * x] + 1) >> 1;
+				out[x + 1] = (row[2 * x + 2] + next[2 * x + 2] + 1) >> 1;
+			}
+		}
+	}
+}
+
+static inline unsigned char clampByte(int x) {
+	return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+// the same fixed point coefficients as libdc1394's YUV2RGB
+static inline void yuvToRgb(int y, int u, int v, unsigned char* out) {
+	out[0] = clampByte(y + ((v * 1436) >> 10));
+	out[1] = clampByte(y - ((u * 352 + v * 731) >> 10));
+	out[2] = clampByte(y + ((u * 1814) >> 10));
+}
+
+template <int r, int b, int channels>
+static void yuv422ToColor(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int, unsigned int start, unsigned int end) {
+	unsigned char rgb[6];
+	for(unsigned int i = start * width / 2; i < end * width / 2; i++) {
+		const unsigned char* p = src + 4 * i;
+		int u = p[0] - 128, v = p[2] - 128;
+		yuvToRgb(p[1], u, v, rgb);
+		yuvToRgb(p[3], u, v, rgb + 3);
+		unsigned char* out = dst + 2 * channels * i;
+		for(int j = 0; j < 2; j++) {
+			out[j * channels + r] = rgb[j * 3];
+			out[j * channels + 1] = rgb[j * 3 + 1];
+			out[j * channels + b] = rgb[j * 3 + 2];
+			if(channels == 4)
+				out[j * channels + 3] = 255;
+		}
+	}
+}
+
+// the color of the sample at column parity x and row parity y
+static constexpr int getSiteColor(dc1394color_filter_t tile, int x, int y) {
+	return tile == DC1394_COLOR_FILTER_RGGB ? (y ? (x ? BLUE : GREEN) : (x ? GREEN : RED)) :
+		tile == DC1394_COLOR_FILTER_GBRG ? (y ? (x ? GREEN : RED) : (x ? BLUE : GREEN)) :
+		tile == DC1394_COLOR_FILTER_GRBG ? (y ? (x ? GREEN : BLUE) : (x ? RED : GREEN)) :
+		(y ? (x ? RED : GREEN) : (x ? GREEN : BLUE));
+}
+
+/*
+ Bilinear interpolation at one site. color is the color sampled there, and
+ neighbor the color of the samples to its left and right, which tells a
+ green site in a red row from one in a blue row. Both are known at compile
+ time, so only one of the branches survives. The output has red at r, blue
+ at b, and opaque alpha if there are four channels.
+ */
+template <int color, int neighbor, int r, int b, int channels>
+static inline void demosaicSite(const unsigned char* up, const unsigned char* row, const unsigned char* down,
+	unsigned int left, unsigned int x, unsigned int right, unsigned char* out) {
+	if(color == GREEN) {
+		unsigned char horizontal = (row[left] + row[right] + 1) >> 1;
+		unsigned char vertical = (up[x] + down[x] + 1) >> 1;
+		out[r] = neighbor == RED ? horizontal : vertical;
+		out[1] = row[x];
+		out[b] = neighbor == RED ? vertical : horizontal;
+	} else {
+		unsigned char cross = (up[x] + down[x] + row[left] + row[right] + 2) >> 2;
+		unsigned char diagonal = (up[left] + up[right] + down[left] + down[right] + 2) >> 2;
+		out[r] = color == RED ? row[x] : diagonal;
+		out[1] = cross;
+		out[b] = color == BLUE ? row[x] : diagonal;
+	}
+	if(channels == 4) {
+		out[3] = 255;
+	}
+}
+
+// mirroring keeps the mosaic pattern intact past the edges
+template <dc1394color_filter_t tile, int rowParity, int r, int b, int channels>
+static void demosaicRow(const unsigned char* up, const unsigned char* row, const unsigned char* down,
+	unsigned char* out, unsigned int width) {
+	const int even = getSiteColor(tile, 0, rowParity);
+	const int odd = getSiteColor(tile, 1, rowParity);
+	demosaicSite<even, odd, r, b, channels>(up, row, down, 1, 0, 1, out);
+	unsigned int x = 1;
+	for(; x + 2 < width; x += 2) {
+		demosaicSite<odd, even, r, b, channels>(up, row, down, x - 1, x, x + 1, out + channels * x);
+		demosaicSite<even, odd, r, b, channels>(up, row, down, x, x + 1, x + 2, out + channels * (x + 1));
+	}
+	for(; x + 1 < width; x++) {
+		if(x % 2) {
+			demosaicSite<odd, even, r, b, channels>(up, row, down, x - 1, x, x + 1, out + channels * x);
+		} else {
+			demosaicSite<even, odd, r, b, channels>(up, row, down, x - 1, x, x + 1, out + channels * x);
+		}
+	}
+	if(x % 2) {
+		demosaicSite<odd, even, r, b, channels>(up, row, down, x - 1, x, x - 1, out + channels * x);
+	} else {
+		demosaicSite<even, odd, r, b, channels>(up, row, down, x - 1, x, x - 1, out + channels * x);
+	}
+}
+
+template <dc1394color_filter_t tile, int r, int b, int channels>
+static void demosaic(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int height, unsigned int start, unsigned int end) {
+	if(width < 2 || height < 2) {
+		return;
+	}
+	for(unsigned int y = start; y < end; y++) {
+		const unsigned char* up = src + (y > 0 ? y - 1 : 1) * width;
+		const unsigned char* row = src + y * width;
+		const unsigned char* down = src + (y + 1 < height ? y + 1 : height - 2) * width;
+		unsigned char* out = dst + y * width * channels;
+		if(y % 2) {
+			demosaicRow<tile, 1, r, b, channels>(up, row, down, out, width);
+		} else {
+			demosaicRow<tile, 0, r, b, channels>(up, row, down, out, width);
+		}
+	}
+}
+
+template <int r, int b, int channels>
+static ConversionKernel getDemosaicKernel(dc1394color_filter_t filter) {
+	switch(filter) {
+		case DC1394_COLOR_FILTER_RGGB: return demosaic<DC1394_COLOR_FILTER_RGGB, r, b, channels>;
+		case DC1394_COLOR_FILTER_GBRG: return demosaic<DC1394_COLOR_FILTER_GBRG, r, b, channels>;
+		case DC1394_COLOR_FILTER_GRBG: return demosaic<DC1394_COLOR_FILTER_GRBG, r, b, channels>;
+		case DC1394_COLOR_FILTER_BGGR: return demosaic<DC1394_COLOR_FILTER_BGGR, r, b, channels>;
+		default: return NULL;
+	}
+}
+
+// a NULL kernel means the conversion goes through the mosaic
+struct FormatConversion {
+	dc1394color_coding_t coding;
+	ofPixelFormat format;
+	ConversionPath path;
+	ConversionKernel kernel;
+};
+
+// ordered from the least host side work to the most, so negotiation takes the first supported coding
+static const FormatConversion formatConversions[] = {
+	{DC1394_COLOR_CODING_MONO8, OF_PIXELS_GRAY, CONVERSION_NONE, copy<1>},
+	{DC1394_COLOR_CODING_RGB8, OF_PIXELS_RGB, CONVERSION_NONE, copy<3>},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_UYVY, CONVERSION_NONE, copy<2>},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_GRAY, CONVERSION_SWIZZLE, yuv422ToGray},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_YUY2, CONVERSION_SWIZZLE, uyvyToYuy2},
+	{DC1394_COLOR_CODING_MONO16, OF_PIXELS_GRAY, CONVERSION_SWIZZLE, sixteenToGray},
+	{DC1394_COLOR_CODING_RAW16, OF_PIXELS_GRAY, CONVERSION_SWIZZLE, sixteenToGray},
+	{DC1394_COLOR_CODING_RGB8, OF_PIXELS_BGR, CONVERSION_SWIZZLE, rgbSwizzle<2, 0, 3>},
+	{DC1394_COLOR_CODING_RGB8, OF_PIXELS_RGBA, CONVERSION_SWIZZLE, rgbSwizzle<0, 2, 4>},
+	{DC1394_COLOR_CODING_RGB8, OF_PIXELS_BGRA, CONVERSION_SWIZZLE, rgbSwizzle<2, 0, 4>},
+	{DC1394_COLOR_CODING_RGB8, OF_PIXELS_GRAY, CONVERSION_FULL, rgbToGray},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_RGB, CONVERSION_FULL, yuv422ToColor<0, 2, 3>},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_BGR, CONVERSION_FULL, yuv422ToColor<2, 0, 3>},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_RGBA, CONVERSION_FULL, yuv422ToColor<0, 2, 4>},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_BGRA, CONVERSION_FULL, yuv422ToColor<2, 0, 4>},
+	{DC1394_COLOR_CODING_YUV422, OF_PIXELS_NV12, CONVERSION_FULL, uyvyToNv12},
+	{DC1394_COLOR_CODING_RAW8, OF_PIXELS_RGB, CONVERSION_FULL, NULL},
+	{DC1394_COLOR_CODING_RAW8, OF_PIXELS_BGR, CONVERSION_FULL, NULL},
+	{DC1394_COLOR_CODING_RAW8, OF_PIXELS_RGBA, CONVERSION_FULL, NULL},
+	{DC1394_COLOR_CODING_RAW8, OF_PIXELS_BGRA, CONVERSION_FULL, NULL},
+	{DC1394_COLOR_CODING_MONO8, OF_PIXELS_RGB, CONVERSION_FULL, monoToRgb}
+};
+
+static ConversionKernel getMosaicKernel(dc1394color_filter_t filter, ofPixelFormat format) {
+	switch(format) {
+		// a grayscale image of a mosaic keeps the raw samples
+		case OF_PIXELS_GRAY: return copy<1>;
+		case OF_PIXELS_RGB: return getDemosaicKernel<0, 2, 3>(filter);
+		case OF_PIXELS_BGR: return getDemosaicKernel<2, 0, 3>(filter);
+		case OF_PIXELS_RGBA: return getDemosaicKernel<0, 2, 4>(filter);
+		case OF_PIXELS_BGRA: return getDemosaicKernel<2, 0, 4>(filter);
+		default: return NULL;
+	}
+}
+
+ConversionKernel getConversionKernel(dc1394color_coding_t coding, dc1394color_filter_t filter, ofPixelFormat format, ConversionPath* path) {
+	if(coding == DC1394_COLOR_CODING_RAW8) {
+		if(path != NULL) {
+			*path = format == OF_PIXELS_GRAY ? CONVERSION_NONE : CONVERSION_FULL;
+		}
+		return getMosaicKernel(filter, format);
+	}
+	for(const FormatConversion& conversion : formatConversions) {
+		if(conversion.coding == coding && conversion.format == format) {
+			if(path != NULL) {
+				*path = conversion.path;
+			}
+			return conversion.kernel;
+		}
+	}
+	return NULL;
+}
+
+ConversionKernel getConversionKernel(dc1394color_coding_t coding, dc1394color_filter_t filter, ofImageType imageType) {
+	return getConversionKernel(coding, filter, imageType == OF_IMAGE_GRAYSCALE ? OF_PIXELS_GRAY : OF_PIXELS_RGB);
+}
+
+vector<dc1394color_coding_t> getSourceCodings(ofPixelFormat format) {
+	vector<dc1394color_coding_t> codings;
+	for(const FormatConversion& conversion : formatConversions) {
+		if(conversion.format == format && conversion.coding != DC1394_COLOR_CODING_RAW8 &&
+			conversion.coding != DC1394_COLOR_CODING_RAW16) {
+			codings.push_back(conversion.coding);
+		}
+	}
+	return codings;
+}
+
+void convertRaw16(const unsigned char* src, unsigned short* dst, unsigned int width, unsigned int height) {
+	for(unsigned int i = 0; i < width * height; i++) {
+		dst[i] = (src[2 * i] << 8) | src[2 * i + 1];
+	}
+}
+
+bool demosaic(const ofPixels& mosaic, ofPixels& rgb, dc1394color_filter_t filter) {
+	ConversionKernel kernel = getConversionKernel(DC1394_COLOR_CODING_RAW8, filter, OF_PIXELS_RGB);
+	unsigned int width = mosaic.getWidth(), height = mosaic.getHeight();
+	if(kernel == NULL || mosaic.getNumChannels() != 1) {
+		return false;
+	}
+	rgb.allocate(width, height, OF_PIXELS_RGB);
+	kernel(mosaic.getData(), rgb.getData(), width, height, 0, height);
+	return true;
+}
+
+bool demosaic(const ofShortPixels& mosaic, ofShortPixels& rgb, dc1394color_filter_t filter, unsigned int bits) {
+	if(mosaic.getNumChannels() != 1) {
+		return false;
+	}
+	rgb.allocate(mosaic.getWidth(), mosaic.getHeight(), OF_PIXELS_RGB);
+	return dc1394_bayer_decoding_16bit(mosaic.getData(), rgb.getData(), mosaic.getWidth(), mosaic.getHeight(),
+		filter, DC1394_BAYER_METHOD_BILINEAR, bits) == DC1394_SUCCESS;
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ Conversion kernels turn a frame from the camera's color coding into the
+ pixels of an ofImage. Each one is a template specialized for its source
+ coding, Bayer tile and output format, so the inner loops don't branch on
+ any of them. Camera looks its kernel up once in applySettings(), and every
+ frame then makes a single indirect call.
+
+	ofxLibdc::ConversionKernel kernel = ofxLibdc::getConversionKernel(
+		DC1394_COLOR_CODING_RAW8, DC1394_COLOR_FILTER_RGGB, OF_IMAGE_COLOR);
+	kernel(src, dst, width, height, 0, height);
+
+ A kernel converts rows start to end of a width x height frame, so a frame
+ can be converted a row at a time while statistics are gathered. Bayer
+ frames are demosaiced bilinearly, mirroring the mosaic at the edges.
+
+ Kernels also exist for the other ofPixelFormats a camera coding maps onto,
+ and report how much work they do: CONVERSION_NONE only copies the frame out
+ of the DMA buffer, CONVERSION_SWIZZLE reorders or drops bytes, and
+ CONVERSION_FULL does arithmetic on every pixel. getSourceCodings() lists the
+ codings that can produce a format, cheapest first, which is the order
+ Camera::setPixelFormat() tries them in.
+
+ Frames from Camera::setRawBayer() keep the mosaic, and can be demosaiced
+ later by whoever needs color:
+
+	if(camera.grabVideo(raw) && camera.getFrameMetadata().mosaic) {
+		ofxLibdc::demosaic(raw.getPixels(), rgb, camera.getFrameMetadata().colorFilter);
+	}
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "dc1394.h"
+
+namespace ofxLibdc {
+
+typedef void (*ConversionKernel)(const unsigned char* src, unsigned char* dst,
+	unsigned int width, unsigned int height, unsigned int start, unsigned int end);
+
+enum ConversionPath {
+	CONVERSION_NONE,
+	CONVERSION_SWIZZLE,
+	CONVERSION_FULL
+};
+
+// returns NULL when there is no kernel for the coding
+ConversionKernel getConversionKernel(dc1394color_coding_t coding, dc1394color_filter_t filter, ofImageType imageType);
+ConversionKernel getConversionKernel(dc1394color_coding_t coding, dc1394color_filter_t filter, ofPixelFormat format,
+	ConversionPath* path = NULL);
+// excludes the RAW codings, which are only used in Bayer mode
+vector<dc1394color_coding_t> getSourceCodings(ofPixelFormat format);
+
+// big-endian 16-bit samples to host order
+void convertRaw16(const unsigned char* src, unsigned short* dst, unsigned int width, unsigned int height);
+// bits is the significant depth of 16-bit samples. false if the input isn't one channel.
+bool demosaic(const ofPixels& mosaic, ofPixels& rgb, dc1394color_filter_t filter);
+bool demosaic(const ofShortPixels& mosaic, ofShortPixels& rgb, dc1394color_filter_t filter, unsigned int bits = 16);
+
+}
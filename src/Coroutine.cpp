@@ -0,0 +1,187 @@
+#include "Coroutine.h"
+
+#ifdef OFXLIBDC_COROUTINES
+
+#include "Camera.h"
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace ofxLibdc {
+
+FrameAwaitable::FrameAwaitable(Camera& camera, Executor executor, float timeout) :
+camera(camera),
+executor(executor),
+timeout(timeout),
+fileno(-1),
+timedOut(false) {
+	dc1394camera_t* libdcCamera = camera.getLibdcCamera();
+	if(libdcCamera != NULL) {
+		fileno = dc1394_capture_get_fileno(libdcCamera);
+	}
+}
+
+bool FrameAwaitable::await_ready() const {
+	// nothing to wait on, resume straight away with an empty handle
+	return fileno < 0;
+}
+
+void FrameAwaitable::await_suspend(coroutine_handle<> handle) {
+	FrameReactor::getInstance().wait(*this, handle);
+}
+
+FrameHandle FrameAwaitable::await_resume() {
+	FrameHandle frame;
+	if(fileno < 0) {
+		ofLogError() << "Awaiting a frame needs a camera that is set up, with a capture file descriptor.";
+		return frame;
+	}
+	if(!timedOut) {
+		camera.grabVideo(frame, false);
+		FrameReactor::getInstance().release(fileno);
+	}
+	return frame;
+}
+
+FrameReactor& FrameReactor::getInstance() {
+	static FrameReactor instance;
+	return instance;
+}
+
+FrameReactor::FrameReactor() :
+running(true) {
+	if(pipe(wakePipe) != 0) {
+		ofLogError() << "Couldn't create the frame reactor's wake pipe.";
+		wakePipe[0] = wakePipe[1] = -1;
+	} else {
+		fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+	}
+	reactor = thread(&FrameReactor::run, this);
+}
+
+FrameReactor::~FrameReactor() {
+	running = false;
+	wake();
+	reactor.join();
+	close(wakePipe[0]);
+	close(wakePipe[1]);
+}
+
+void FrameReactor::wait(FrameAwaitable& awaitable, coroutine_handle<> handle) {
+	Waiter waiter;
+	waiter.awaitable = &awaitable;
+	waiter.handle = handle;
+	waiter.deadline = awaitable.timeout >= 0 ? ofGetElapsedTimeMicros() + (uint64_t) (awaitable.timeout * 1e6) : 0;
+	{
+		lock_guard<mutex> guard(lock);
+		waiters[awaitable.fileno].push_back(waiter);
+	}
+	wake();
+}
+
+void FrameReactor::release(int fileno) {
+	{
+		lock_guard<mutex> guard(lock);
+		busy.erase(fileno);
+	}
+	wake();
+}
+
+void FrameReactor::wake() {
+	char byte = 0;
+	if(write(wakePipe[1], &byte, 1) < 0) {
+		// the pipe is already full, so the reactor is awake anyway
+	}
+}
+
+void FrameReactor::run() {
+	vector<pollfd> fds;
+	vector<Waiter> ready;
+	while(running) {
+		fds.clear();
+		pollfd wakeFd = {wakePipe[0], POLLIN, 0};
+		fds.push_back(wakeFd);
+		int timeoutMillis = -1;
+		{
+			lock_guard<mutex> guard(lock);
+			uint64_t now = ofGetElapsedTimeMicros();
+			for(map<int, deque<Waiter> >::iterator it = waiters.begin(); it != waiters.end(); it++) {
+				deque<Waiter>& queue = it->second;
+				if(!queue.empty() && !busy.count(it->first)) {
+					pollfd fd = {it->first, POLLIN, 0};
+					fds.push_back(fd);
+				}
+				for(unsigned int i = 0; i < queue.size(); i++) {
+					if(queue[i].deadline > 0) {
+						int remaining = queue[i].deadline > now ? (queue[i].deadline - now + 999) / 1000 : 0;
+						timeoutMillis = timeoutMillis < 0 ? remaining : min(timeoutMillis, remaining);
+					}
+				}
+			}
+		}
+
+		poll(&fds[0], fds.size(), timeoutMillis);
+		if(fds[0].revents & POLLIN) {
+			char buffer[64];
+			while(read(wakePipe[0], buffer, sizeof(buffer)) > 0);
+		}
+
+		ready.clear();
+		{
+			lock_guard<mutex> guard(lock);
+			// one waiter per camera, the next is resumed after this one grabs
+			for(unsigned int i = 1; i < fds.size(); i++) {
+				if(fds[i].revents & POLLNVAL) {
+					// the camera was closed or set up again, so nothing will
+					// arrive on this descriptor and every waiter gets an empty handle
+					deque<Waiter>& queue = waiters[fds[i].fd];
+					for(unsigned int j = 0; j < queue.size(); j++) {
+						queue[j].awaitable->timedOut = true;
+						ready.push_back(queue[j]);
+					}
+					waiters.erase(fds[i].fd);
+					busy.erase(fds[i].fd);
+				} else if(fds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+					deque<Waiter>& queue = waiters[fds[i].fd];
+					if(!queue.empty()) {
+						ready.push_back(queue.front());
+						queue.pop_front();
+						busy.insert(fds[i].fd);
+					}
+				}
+			}
+			uint64_t now = ofGetElapsedTimeMicros();
+			for(map<int, deque<Waiter> >::iterator it = waiters.begin(); it != waiters.end();) {
+				deque<Waiter>& queue = it->second;
+				for(unsigned int i = 0; i < queue.size();) {
+					if(queue[i].deadline > 0 && queue[i].deadline <= now) {
+						queue[i].awaitable->timedOut = true;
+						ready.push_back(queue[i]);
+						queue.erase(queue.begin() + i);
+					} else {
+						i++;
+					}
+				}
+				if(queue.empty() && !busy.count(it->first)) {
+					waiters.erase(it++);
+				} else {
+					it++;
+				}
+			}
+		}
+
+		for(unsigned int i = 0; i < ready.size(); i++) {
+			Executor& executor = ready[i].awaitable->executor;
+			if(executor) {
+				executor(ready[i].handle);
+			} else {
+				ready[i].handle.resume();
+			}
+		}
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ With a C++20 compiler, ofxLibdc::Camera can be awaited from a coroutine:
+
+	ofxLibdc::FrameHandle frame = co_await camera.nextFrame(executor);
+	ofxLibdc::FrameHandle frame = co_await camera.nextFrame(.5, executor); // empty on timeout
+
+ Awaiting doesn't tie up a thread. One reactor thread watches the capture
+ file descriptors of every camera with poll(), and when a frame is ready it
+ passes the coroutine to the executor you supply, for example a function
+ that posts it to your thread pool. The frame is converted into a pooled
+ buffer (see FramePool.h) on whichever thread resumes the coroutine, so
+ conversion work is spread over the executor rather than the reactor.
+ Without an executor, coroutines resume on the reactor thread itself.
+
+ Only one waiter per camera is resumed at a time, so several tasks awaiting
+ the same camera receive consecutive frames. An empty handle means the wait
+ timed out, the frame was taken by another grab on the same camera, or the
+ camera was closed or set up again while waiting.
+
+ This needs libdc1394's capture file descriptor, which is only available on
+ Linux.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "FramePool.h"
+
+#ifndef OFXLIBDC_COROUTINES
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define OFXLIBDC_COROUTINES
+#endif
+#endif
+
+#ifdef OFXLIBDC_COROUTINES
+
+#include <coroutine>
+#include <atomic>
+
+namespace ofxLibdc {
+
+class Camera;
+
+// takes over a coroutine that is ready to resume
+typedef function<void(coroutine_handle<>)> Executor;
+
+class FrameAwaitable {
+public:
+	// a negative timeout waits forever
+	FrameAwaitable(Camera& camera, Executor executor, float timeout);
+
+	bool await_ready() const;
+	void await_suspend(coroutine_handle<> handle);
+	FrameHandle await_resume();
+
+protected:
+	friend class FrameReactor;
+	Camera& camera;
+	Executor executor;
+	float timeout;
+	int fileno;
+	bool timedOut;
+};
+
+class FrameReactor {
+public:
+	static FrameReactor& getInstance();
+	~FrameReactor();
+
+	void wait(FrameAwaitable& awaitable, coroutine_handle<> handle);
+	// lets the next waiter on this descriptor be resumed
+	void release(int fileno);
+
+protected:
+	FrameReactor();
+	void run();
+	void wake();
+
+	struct Waiter {
+		FrameAwaitable* awaitable;
+		coroutine_handle<> handle;
+		uint64_t deadline; // 0 for none
+	};
+	mutex lock;
+	map<int, deque<Waiter> > waiters;
+	set<int> busy;
+	int wakePipe[2];
+	atomic<bool> running;
+	thread reactor;
+};
+
+}
+
+#endif
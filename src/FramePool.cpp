@@ -0,0 +1,169 @@
+#include "FramePool.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace ofxLibdc {
+
+static ofPixelFormat getPixelFormat(ofImageType imageType) {
+	switch(imageType) {
+		case OF_IMAGE_COLOR: return OF_PIXELS_RGB;
+		case OF_IMAGE_COLOR_ALPHA: return OF_PIXELS_RGBA;
+		default: return OF_PIXELS_GRAY;
+	}
+}
+
+FramePool::State::~State() {
+	for(unsigned int i = 0; i < free.size(); i++)
+		freeBuffer(free[i]);
+}
+
+FramePool::FramePool(unsigned int minFrames, unsigned int maxFrames) :
+state(new State()) {
+	state->minFrames = minFrames;
+	state->maxFrames = max(minFrames, maxFrames);
+	state->width = state->height = 0;
+	state->pixelFormat = OF_PIXELS_GRAY;
+	state->frameBytes = 0;
+	state->inUse = state->peakInUse = state->sinceTrim = 0;
+	state->generation = 0;
+	memset(&state->statistics, 0, sizeof(state->statistics));
+}
+
+void FramePool::setLimits(unsigned int minFrames, unsigned int maxFrames) {
+	lock_guard<mutex> lock(state->lock);
+	state->minFrames = minFrames;
+	state->maxFrames = max(minFrames, maxFrames);
+	// spare buffers beyond the new maximum aren't needed
+	while(!state->free.empty() && state->free.size() + state->inUse > state->maxFrames) {
+		freeBuffer(state->free.back());
+		state->free.pop_back();
+	}
+}
+
+void FramePool::allocate(unsigned int width, unsigned int height, ofImageType imageType) {
+	allocate(width, height, getPixelFormat(imageType));
+}
+
+void FramePool::allocate(unsigned int width, unsigned int height, ofPixelFormat pixelFormat) {
+	lock_guard<mutex> lock(state->lock);
+	setFormat(*state, width, height, pixelFormat);
+	while(state->free.size() + state->inUse < state->minFrames) {
+		state->free.push_back(allocateBuffer(state->frameBytes, state->generation));
+	}
+}
+
+FrameHandle FramePool::acquire(unsigned int width, unsigned int height, ofImageType imageType) {
+	return acquire(width, height, getPixelFormat(imageType));
+}
+
+FrameHandle FramePool::acquire(unsigned int width, unsigned int height, ofPixelFormat pixelFormat) {
+	Buffer buffer;
+	{
+		lock_guard<mutex> lock(state->lock);
+		setFormat(*state, width, height, pixelFormat);
+		if(!state->free.empty()) {
+			buffer = state->free.back();
+			state->free.pop_back();
+			state->statistics.hits++;
+		} else if(state->inUse < state->maxFrames) {
+			buffer = allocateBuffer(state->frameBytes, state->generation);
+			state->statistics.misses++;
+			if(buffer.data == NULL)
+				return FrameHandle();
+		} else {
+			state->statistics.exhausted++;
+			return FrameHandle();
+		}
+		state->inUse++;
+		state->peakInUse = max(state->peakInUse, state->inUse);
+		if(++state->sinceTrim >= OFXLIBDC_POOL_TRIM_INTERVAL) {
+			trim(*state);
+		}
+	}
+
+	PooledFrame* frame = new PooledFrame();
+	frame->pixels.setFromExternalPixels(buffer.data, width, height, pixelFormat);
+	frame->timestamp = 0;
+	frame->framesBehind = 0;
+	frame->left = frame->top = 0;
+	frame->exposureStart = 0;
+	frame->mosaic = false;
+	frame->colorFilter = DC1394_COLOR_FILTER_RGGB;
+	shared_ptr<State> owner = state;
+	return FrameHandle(frame, [owner, buffer](PooledFrame* frame) {
+		release(owner, frame, buffer);
+	});
+}
+
+FramePoolStatistics FramePool::getStatistics() const {
+	lock_guard<mutex> lock(state->lock);
+	FramePoolStatistics statistics = state->statistics;
+	statistics.inUse = state->inUse;
+	statistics.free = state->free.size();
+	statistics.allocated = statistics.inUse + statistics.free;
+	return statistics;
+}
+
+void FramePool::relocate() {
+	lock_guard<mutex> lock(state->lock);
+	state->generation++;
+	for(unsigned int i = 0; i < state->free.size(); i++)
+		freeBuffer(state->free[i]);
+	state->free.clear();
+}
+
+FramePool::Buffer FramePool::allocateBuffer(size_t size, unsigned int generation) {
+	Buffer buffer;
+	buffer.size = size;
+	buffer.generation = generation;
+	buffer.data = NULL;
+	if(posix_memalign((void**) &buffer.data, OFXLIBDC_POOL_ALIGNMENT, max(size, (size_t) 1)) != 0) {
+		ofLogError() << "Couldn't allocate a " << size << " byte frame.";
+		buffer.data = NULL;
+	}
+	return buffer;
+}
+
+void FramePool::freeBuffer(Buffer& buffer) {
+	::free(buffer.data);
+	buffer.data = NULL;
+}
+
+// call with the lock held
+void FramePool::setFormat(State& state, unsigned int width, unsigned int height, ofPixelFormat pixelFormat) {
+	if(width == state.width && height == state.height && pixelFormat == state.pixelFormat) {
+		return;
+	}
+	state.width = width;
+	state.height = height;
+	state.pixelFormat = pixelFormat;
+	state.frameBytes = ofPixels::bytesFromPixelFormat(width, height, pixelFormat);
+	for(unsigned int i = 0; i < state.free.size(); i++)
+		freeBuffer(state.free[i]);
+	state.free.clear();
+}
+
+void FramePool::release(shared_ptr<State> state, PooledFrame* frame, Buffer buffer) {
+	delete frame;
+	lock_guard<mutex> lock(state->lock);
+	state->inUse--;
+	if(buffer.size == state->frameBytes && buffer.generation == state->generation && buffer.data != NULL &&
+		state->free.size() + state->inUse < state->maxFrames) {
+		state->free.push_back(buffer);
+	} else {
+		freeBuffer(buffer);
+	}
+}
+
+// frees spare buffers the last interval never needed
+void FramePool::trim(State& state) {
+	unsigned int keep = max(state.minFrames, state.peakInUse);
+	while(!state.free.empty() && state.free.size() + state.inUse > keep) {
+		freeBuffer(state.free.back());
+		state.free.pop_back();
+	}
+	state.peakInUse = state.inUse;
+	state.sinceTrim = 0;
+}
+
+}
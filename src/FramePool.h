@@ -0,0 +1,95 @@
+/*
+ ofxLibdc::FramePool recycles frame buffers, so frames can be kept past the
+ next grab without copying them or going back to the allocator.
+
+	ofxLibdc::FrameHandle frame;
+	camera.getFramePool().setLimits(4, 32);
+	if(camera.grabVideo(frame)) {
+		history.push_back(frame); // no copy
+	}
+
+ A FrameHandle is a shared_ptr, and its buffer goes back to the pool when the
+ last copy of the handle is destroyed. Handles stay valid after the pool or
+ camera is gone, their buffers are just freed instead of recycled.
+
+ Buffers are 64-byte aligned and sized for the current mode. The pool
+ preallocates minFrames, grows on demand up to maxFrames, and every
+ OFXLIBDC_POOL_TRIM_INTERVAL acquisitions frees spare buffers that went
+ unused since the last trim, down to minFrames. When the mode changes, buffers
+ of the old size are freed as they come back.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "dc1394.h"
+
+namespace ofxLibdc {
+
+#define OFXLIBDC_POOL_ALIGNMENT 64
+#define OFXLIBDC_POOL_TRIM_INTERVAL 256
+
+struct PooledFrame {
+	ofPixels pixels;
+	uint64_t timestamp; // host time in microseconds when the frame was received
+	unsigned int framesBehind;
+	unsigned int left, top;
+	uint64_t exposureStart; // steady_clock microseconds, see ClockModel.h
+	bool mosaic; // raw Bayer samples, see Camera::setRawBayer()
+	dc1394color_filter_t colorFilter;
+};
+
+typedef shared_ptr<PooledFrame> FrameHandle;
+
+struct FramePoolStatistics {
+	uint64_t hits; // acquisitions served by a recycled buffer
+	uint64_t misses; // acquisitions that had to allocate
+	uint64_t exhausted; // acquisitions refused because maxFrames were in use
+	unsigned int allocated, inUse, free;
+};
+
+class FramePool {
+public:
+	FramePool(unsigned int minFrames = 2, unsigned int maxFrames = 16);
+
+	void setLimits(unsigned int minFrames, unsigned int maxFrames);
+	// preallocates minFrames buffers of this size
+	void allocate(unsigned int width, unsigned int height, ofImageType imageType);
+	void allocate(unsigned int width, unsigned int height, ofPixelFormat pixelFormat);
+	// returns an empty handle if every buffer is in use
+	FrameHandle acquire(unsigned int width, unsigned int height, ofImageType imageType);
+	FrameHandle acquire(unsigned int width, unsigned int height, ofPixelFormat pixelFormat);
+	FramePoolStatistics getStatistics() const;
+	// frees every spare buffer, and the ones in use as they come back, so new
+	// buffers are allocated and first touched by the thread that acquires them
+	void relocate();
+
+protected:
+	struct Buffer {
+		unsigned char* data;
+		size_t size;
+		unsigned int generation;
+	};
+	// shared with the handles, so they can return buffers after the pool is gone
+	struct State {
+		mutex lock;
+		unsigned int minFrames, maxFrames;
+		unsigned int width, height;
+		ofPixelFormat pixelFormat;
+		size_t frameBytes;
+		vector<Buffer> free;
+		unsigned int inUse, peakInUse, sinceTrim;
+		unsigned int generation; // bumped by relocate()
+		FramePoolStatistics statistics;
+		~State();
+	};
+	shared_ptr<State> state;
+
+	static Buffer allocateBuffer(size_t size, unsigned int generation);
+	static void freeBuffer(Buffer& buffer);
+	static void setFormat(State& state, unsigned int width, unsigned int height, ofPixelFormat pixelFormat);
+	static void release(shared_ptr<State> state, PooledFrame* frame, Buffer buffer);
+	static void trim(State& state);
+};
+
+}
@@ -66,4 +66,12 @@ const ofPixels& Grabber::getPixels() const {
     return buffer.getPixels();
 }
 
+bool Grabber::setPixelFormat(ofPixelFormat pixelFormat) {
+	return Camera::setPixelFormat(pixelFormat);
+}
+
+ofPixelFormat Grabber::getPixelFormat() const {
+	return Camera::getPixelFormat();
+}
+
 }
\ No newline at end of file
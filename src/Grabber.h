@@ -38,8 +38,8 @@ public:
     const ofPixels& getPixels() const override;
     
     bool isInitialized() const override {return true;}
-    bool setPixelFormat(ofPixelFormat pixelFormat) override {}
-    ofPixelFormat getPixelFormat() const override {return OF_PIXELS_UNKNOWN;}
+    bool setPixelFormat(ofPixelFormat pixelFormat) override;
+    ofPixelFormat getPixelFormat() const override;
     
 protected:
 	ofImage buffer;
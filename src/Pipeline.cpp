@@ -0,0 +1,186 @@
+#include "Pipeline.h"
+#include "Camera.h"
+
+namespace ofxLibdc {
+
+// how long idle threads sleep between checks of an empty or full queue
+#define OFXLIBDC_PIPELINE_IDLE_MICROS 100
+
+static void updateMax(atomic<uint64_t>& maximum, uint64_t value) {
+	uint64_t current = maximum.load(memory_order_relaxed);
+	while(value > current && !maximum.compare_exchange_weak(current, value, memory_order_relaxed)) {
+	}
+}
+
+Pipeline::Pipeline() :
+running(false),
+camera(NULL),
+capture(new Stage()) {
+	capture->name = "capture";
+	capture->policy = DROP_NEWEST;
+	capture->threads = 1;
+}
+
+Pipeline::~Pipeline() {
+	stop();
+}
+
+void Pipeline::addStage(string name, StageFunction function, unsigned int capacity, DropPolicy policy, unsigned int threads) {
+	if(running) {
+		ofLogError() << "Stop the pipeline before adding stage " << name << ".";
+		return;
+	}
+	unique_ptr<Stage> stage(new Stage());
+	stage->name = name;
+	stage->function = function;
+	stage->policy = policy;
+	stage->threads = max(threads, 1u);
+	stage->queue.reset(new BoundedQueue<FrameHandle>(max(capacity, 1u)));
+	stages.push_back(move(stage));
+}
+
+void Pipeline::start(Camera& camera) {
+	if(running) {
+		return;
+	}
+	if(stages.empty()) {
+		ofLogWarning() << "Starting a pipeline without any stages.";
+	}
+	this->camera = &camera;
+	resetCounters(*capture);
+	for(unsigned int i = 0; i < stages.size(); i++)
+		resetCounters(*stages[i]);
+	running = true;
+	workers.push_back(thread(&Pipeline::captureThread, this));
+	for(unsigned int i = 0; i < stages.size(); i++) {
+		for(unsigned int j = 0; j < stages[i]->threads; j++)
+			workers.push_back(thread(&Pipeline::stageThread, this, i));
+	}
+}
+
+void Pipeline::stop() {
+	if(!running) {
+		return;
+	}
+	running = false;
+	for(unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+	// release any frames that were still queued
+	FrameHandle frame;
+	for(unsigned int i = 0; i < stages.size(); i++)
+		while(stages[i]->queue->tryPop(frame));
+}
+
+bool Pipeline::isRunning() const {
+	return running;
+}
+
+void Pipeline::captureThread() {
+	// polling, so stop() never waits on a camera that has stopped sending
+	bool blocking = camera->getBlocking();
+	camera->setBlocking(false);
+	while(running) {
+		FrameHandle frame;
+		uint64_t start = ofGetElapsedTimeMicros();
+		if(!camera->grabVideo(frame, false)) {
+			this_thread::sleep_for(chrono::microseconds(OFXLIBDC_PIPELINE_IDLE_MICROS));
+			continue;
+		}
+		uint64_t service = ofGetElapsedTimeMicros() - start;
+		capture->processed++;
+		capture->serviceMicros += service;
+		updateMax(capture->maxServiceMicros, service);
+		if(!stages.empty())
+			push(*stages[0], frame);
+	}
+	camera->setBlocking(blocking);
+}
+
+void Pipeline::stageThread(unsigned int index) {
+	Stage& stage = *stages[index];
+	Stage* next = index + 1 < stages.size() ? stages[index + 1].get() : NULL;
+	FrameHandle frame;
+	while(running) {
+		if(!stage.queue->tryPop(frame)) {
+			this_thread::sleep_for(chrono::microseconds(OFXLIBDC_PIPELINE_IDLE_MICROS));
+			continue;
+		}
+		uint64_t start = ofGetElapsedTimeMicros();
+		bool keep = stage.function(frame);
+		uint64_t service = ofGetElapsedTimeMicros() - start;
+		stage.serviceMicros += service;
+		updateMax(stage.maxServiceMicros, service);
+		if(keep) {
+			stage.processed++;
+			if(next != NULL && frame)
+				push(*next, frame);
+		} else {
+			stage.rejected++;
+		}
+		frame.reset();
+	}
+}
+
+void Pipeline::push(Stage& stage, FrameHandle& frame) {
+	if(stage.queue->tryPush(frame)) {
+		return;
+	}
+	switch(stage.policy) {
+		case DROP_NEWEST:
+			stage.dropped++;
+			break;
+		case DROP_OLDEST: {
+			// make room by discarding the oldest frame, another producer may take it first
+			FrameHandle oldest;
+			while(!stage.queue->tryPush(frame)) {
+				if(stage.queue->tryPop(oldest)) {
+					stage.dropped++;
+				}
+			}
+			break;
+		}
+		case BLOCK: {
+			uint64_t start = ofGetElapsedTimeMicros();
+			while(running && !stage.queue->tryPush(frame)) {
+				this_thread::sleep_for(chrono::microseconds(OFXLIBDC_PIPELINE_IDLE_MICROS));
+			}
+			stage.blockedMicros += ofGetElapsedTimeMicros() - start;
+			break;
+		}
+	}
+}
+
+void Pipeline::resetCounters(Stage& stage) {
+	stage.processed = 0;
+	stage.dropped = 0;
+	stage.rejected = 0;
+	stage.serviceMicros = 0;
+	stage.maxServiceMicros = 0;
+	stage.blockedMicros = 0;
+}
+
+StageMetrics Pipeline::getMetrics(const Stage& stage) {
+	StageMetrics metrics;
+	metrics.name = stage.name;
+	metrics.occupancy = stage.queue ? stage.queue->size() : 0;
+	metrics.capacity = stage.queue ? stage.queue->capacity() : 0;
+	metrics.processed = stage.processed;
+	metrics.dropped = stage.dropped;
+	metrics.rejected = stage.rejected;
+	uint64_t serviced = metrics.processed + metrics.rejected;
+	metrics.meanServiceTime = serviced > 0 ? stage.serviceMicros / 1e6 / serviced : 0;
+	metrics.maxServiceTime = stage.maxServiceMicros / 1e6;
+	metrics.blockedTime = stage.blockedMicros / 1e6;
+	return metrics;
+}
+
+vector<StageMetrics> Pipeline::getMetrics() const {
+	vector<StageMetrics> metrics;
+	metrics.push_back(getMetrics(*capture));
+	for(unsigned int i = 0; i < stages.size(); i++)
+		metrics.push_back(getMetrics(*stages[i]));
+	return metrics;
+}
+
+}
@@ -0,0 +1,171 @@
+/*
+ ofxLibdc::Pipeline runs a chain of processing stages on worker threads,
+ connected by bounded lock-free queues.
+
+	ofxLibdc::Pipeline pipeline;
+	pipeline.addStage("undistort", undistort, 4, ofxLibdc::Pipeline::DROP_OLDEST);
+	pipeline.addStage("track", track, 2, ofxLibdc::Pipeline::BLOCK);
+	pipeline.start(camera);
+	...
+	vector<ofxLibdc::StageMetrics> metrics = pipeline.getMetrics();
+
+ A capture thread grabs pooled frames from the camera (see FramePool.h) and
+ feeds the first stage. Each stage function receives a FrameHandle. It can
+ modify the frame in place or replace the handle, and it returns false to
+ drop the frame. Whatever the last stage returns is released.
+
+ Every stage has an input queue with one of three policies for when it is
+ full: DROP_OLDEST discards the oldest waiting frame, which keeps latency
+ low; DROP_NEWEST discards the incoming frame; BLOCK makes the upstream
+ stage wait, which pushes back up to the capture thread and eventually to
+ the DMA ring. Queue capacities are rounded up to a power of two.
+
+ getMetrics() reports the occupancy, service time, and drop counts of every
+ stage. The capture thread is reported as the first entry, so an overloaded
+ stage shows up by name.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "FramePool.h"
+#include <atomic>
+
+namespace ofxLibdc {
+
+class Camera;
+
+// Dmitry Vyukov's bounded multi-producer multi-consumer queue. Every cell
+// carries a sequence number, so producers and consumers only contend on
+// their own position counter.
+template <typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity) {
+		size_t size = 2;
+		while(size < capacity)
+			size *= 2;
+		mask = size - 1;
+		cells.reset(new Cell[size]);
+		for(size_t i = 0; i < size; i++)
+			cells[i].sequence.store(i, memory_order_relaxed);
+		enqueuePosition.store(0, memory_order_relaxed);
+		dequeuePosition.store(0, memory_order_relaxed);
+	}
+	bool tryPush(const T& value) {
+		size_t position = enqueuePosition.load(memory_order_relaxed);
+		while(true) {
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(memory_order_acquire);
+			intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+			if(difference == 0) {
+				if(enqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+					cell.data = value;
+					cell.sequence.store(position + 1, memory_order_release);
+					return true;
+				}
+			} else if(difference < 0) {
+				return false;
+			} else {
+				position = enqueuePosition.load(memory_order_relaxed);
+			}
+		}
+	}
+	bool tryPop(T& value) {
+		size_t position = dequeuePosition.load(memory_order_relaxed);
+		while(true) {
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(memory_order_acquire);
+			intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+			if(difference == 0) {
+				if(dequeuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+					value = cell.data;
+					// don't hold on to the frame while the cell waits to be reused
+					cell.data = T();
+					cell.sequence.store(position + mask + 1, memory_order_release);
+					return true;
+				}
+			} else if(difference < 0) {
+				return false;
+			} else {
+				position = dequeuePosition.load(memory_order_relaxed);
+			}
+		}
+	}
+	size_t size() const {
+		size_t enqueued = enqueuePosition.load(memory_order_relaxed);
+		size_t dequeued = dequeuePosition.load(memory_order_relaxed);
+		return enqueued > dequeued ? min(enqueued - dequeued, capacity()) : 0;
+	}
+	size_t capacity() const {
+		return mask + 1;
+	}
+
+protected:
+	struct Cell {
+		atomic<size_t> sequence;
+		T data;
+	};
+	unique_ptr<Cell[]> cells;
+	size_t mask;
+	// on separate cache lines, so producers and consumers don't false share
+	alignas(64) atomic<size_t> enqueuePosition;
+	alignas(64) atomic<size_t> dequeuePosition;
+};
+
+struct StageMetrics {
+	string name;
+	unsigned int occupancy, capacity; // frames waiting in the input queue
+	uint64_t processed; // frames the stage finished
+	uint64_t dropped; // frames its queue policy discarded
+	uint64_t rejected; // frames the stage itself returned false for
+	float meanServiceTime, maxServiceTime; // seconds per frame
+	float blockedTime; // seconds upstream spent waiting on a full queue
+};
+
+class Pipeline {
+public:
+	enum DropPolicy {
+		DROP_OLDEST,
+		DROP_NEWEST,
+		BLOCK
+	};
+	typedef function<bool(FrameHandle&)> StageFunction;
+
+	Pipeline();
+	~Pipeline();
+
+	// stages can only be added while the pipeline is stopped
+	void addStage(string name, StageFunction function, unsigned int capacity = 4,
+		DropPolicy policy = DROP_OLDEST, unsigned int threads = 1);
+	void start(Camera& camera);
+	void stop();
+	bool isRunning() const;
+
+	vector<StageMetrics> getMetrics() const;
+
+protected:
+	struct Stage {
+		string name;
+		StageFunction function;
+		DropPolicy policy;
+		unsigned int threads;
+		unique_ptr<BoundedQueue<FrameHandle> > queue;
+		atomic<uint64_t> processed, dropped, rejected;
+		atomic<uint64_t> serviceMicros, maxServiceMicros, blockedMicros;
+	};
+	vector<unique_ptr<Stage> > stages;
+	vector<thread> workers;
+	atomic<bool> running;
+	Camera* camera;
+	unique_ptr<Stage> capture;
+
+	void captureThread();
+	void stageThread(unsigned int index);
+	// hands a frame to a stage's queue according to its policy
+	void push(Stage& stage, FrameHandle& frame);
+	static void resetCounters(Stage& stage);
+	static StageMetrics getMetrics(const Stage& stage);
+};
+
+}
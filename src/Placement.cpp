@@ -0,0 +1,210 @@
+#include "Placement.h"
+#include "Camera.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#ifdef TARGET_LINUX
+#include <dirent.h>
+#endif
+
+namespace ofxLibdc {
+
+static string joinCores(const vector<int>& cores) {
+	ostringstream out;
+	for(unsigned int i = 0; i < cores.size(); i++)
+		out << (i > 0 ? "," : "") << cores[i];
+	return out.str();
+}
+
+string PlacementReport::toString() const {
+	ostringstream out;
+	out << "cores " << (cores.empty() ? "any" : joinCores(cores)) <<
+		", priority " << (priority > 0 ? ofToString(priority) : "normal") <<
+		", numa node " << (numaNode >= 0 ? ofToString(numaNode) : "any") <<
+		(applied ? "" : " (not everything could be applied)");
+	return out.str();
+}
+
+int getNumaNode(int core) {
+#ifdef TARGET_LINUX
+	// each cpu directory has a nodeN link to the node it belongs to
+	string path = "/sys/devices/system/cpu/cpu" + ofToString(core);
+	DIR* dir = opendir(path.c_str());
+	if(dir == NULL) {
+		return -1;
+	}
+	int node = -1;
+	while(dirent* entry = readdir(dir)) {
+		int n;
+		if(sscanf(entry->d_name, "node%d", &n) == 1) {
+			node = n;
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+#else
+	return -1;
+#endif
+}
+
+PlacementReport applyPlacement(const ThreadPlacement& placement) {
+	PlacementReport report;
+	report.applied = true;
+	pthread_t self = pthread_self();
+
+#ifdef TARGET_LINUX
+	if(!placement.cores.empty()) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for(unsigned int i = 0; i < placement.cores.size(); i++)
+			CPU_SET(placement.cores[i], &cpus);
+		if(pthread_setaffinity_np(self, sizeof(cpus), &cpus) != 0) {
+			ofLogWarning() << "Couldn't pin the capture thread to cores " << joinCores(placement.cores) << ".";
+			report.applied = false;
+		}
+	}
+	cpu_set_t cpus;
+	if(pthread_getaffinity_np(self, sizeof(cpus), &cpus) == 0) {
+		for(int i = 0; i < CPU_SETSIZE; i++)
+			if(CPU_ISSET(i, &cpus))
+				report.cores.push_back(i);
+	}
+
+	// pages are placed by first touch, so this only holds while the thread
+	// stays on the node of its first core
+	if(placement.numaLocal && !placement.cores.empty()) {
+		int node = getNumaNode(placement.cores[0]);
+		bool sameNode = true;
+		for(unsigned int i = 1; i < placement.cores.size(); i++)
+			sameNode = sameNode && getNumaNode(placement.cores[i]) == node;
+		if(node >= 0 && sameNode) {
+			report.numaNode = node;
+		} else if(!sameNode) {
+			ofLogWarning() << "Cores " << joinCores(placement.cores) << " span several NUMA nodes, buffers won't be node local.";
+			report.applied = false;
+		}
+	}
+#else
+	if(!placement.cores.empty()) {
+		ofLogWarning() << "Thread affinity is only supported on Linux.";
+		report.applied = false;
+	}
+#endif
+
+	if(placement.priority > 0) {
+		sched_param param;
+		param.sched_priority = ofClamp(placement.priority, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+		if(pthread_setschedparam(self, SCHED_FIFO, &param) != 0) {
+			ofLogWarning() << "Couldn't set SCHED_FIFO priority " << param.sched_priority << ", this usually needs root or CAP_SYS_NICE.";
+			report.applied = false;
+		}
+	}
+	int policy;
+	sched_param param;
+	if(pthread_getschedparam(self, &policy, &param) == 0 && policy == SCHED_FIFO) {
+		report.priority = param.sched_priority;
+	}
+
+	ofLogVerbose() << "Capture thread placement: " << report.toString();
+	return report;
+}
+
+static float getMean(const vector<float>& values) {
+	double sum = 0;
+	for(unsigned int i = 0; i < values.size(); i++)
+		sum += values[i];
+	return values.empty() ? 0 : sum / values.size();
+}
+
+static float getDeviation(const vector<float>& values, float mean) {
+	double sum = 0;
+	for(unsigned int i = 0; i < values.size(); i++)
+		sum += (values[i] - mean) * (values[i] - mean);
+	return values.empty() ? 0 : sqrt(sum / values.size());
+}
+
+string JitterStatistics::toString() const {
+	ostringstream out;
+	out << frames << " frames, " << dropped << " dropped, " <<
+		"interval " << meanInterval * 1000 << " +/- " << intervalDeviation * 1000 << " ms, " <<
+		"latency " << meanLatency * 1000 << " +/- " << latencyDeviation * 1000 << " ms, " <<
+		"99% " << percentile99Latency * 1000 << " ms, max " << maxLatency * 1000 << " ms, " <<
+		placement.toString();
+	return out.str();
+}
+
+// libdc1394 timestamps frames in microseconds since the epoch
+static uint64_t getSystemMicros() {
+	timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+JitterStatistics measureJitter(Camera& camera, unsigned int frames) {
+	JitterStatistics statistics;
+	ofImage img;
+	img.setUseTexture(false);
+	vector<uint64_t> timestamps;
+	vector<float> latencies;
+
+	// start from an empty ring, then wait for each frame as it arrives
+	bool blocking = camera.getBlocking();
+	camera.setBlocking(false);
+	camera.grabVideo(img, true);
+	camera.setBlocking(true);
+	for(unsigned int i = 0; i < frames; i++) {
+		if(!camera.grabVideo(img, false)) {
+			break;
+		}
+		uint64_t delivered = getSystemMicros();
+		uint64_t timestamp = camera.getFrameMetadata().timestamp;
+		timestamps.push_back(timestamp);
+		latencies.push_back(delivered > timestamp ? (delivered - timestamp) / 1e6 : 0);
+	}
+	camera.setBlocking(blocking);
+	statistics.placement = camera.getPlacementReport();
+	if(timestamps.size() < 2) {
+		ofLogWarning() << "Not enough frames arrived to measure jitter.";
+		return statistics;
+	}
+
+	vector<float> intervals;
+	for(unsigned int i = 1; i < timestamps.size(); i++)
+		intervals.push_back((timestamps[i] - timestamps[i - 1]) / 1e6);
+	vector<float> sorted = intervals;
+	sort(sorted.begin(), sorted.end());
+	float median = sorted[sorted.size() / 2];
+	for(unsigned int i = 0; i < intervals.size(); i++) {
+		if(median > 0 && intervals[i] > median * 1.5)
+			statistics.dropped += (unsigned int) (intervals[i] / median + .5) - 1;
+	}
+
+	statistics.frames = timestamps.size();
+	statistics.meanInterval = getMean(intervals);
+	statistics.intervalDeviation = getDeviation(intervals, statistics.meanInterval);
+	statistics.meanLatency = getMean(latencies);
+	statistics.latencyDeviation = getDeviation(latencies, statistics.meanLatency);
+	sort(latencies.begin(), latencies.end());
+	statistics.maxLatency = latencies.back();
+	statistics.percentile99Latency = latencies[min((size_t) (latencies.size() * .99), latencies.size() - 1)];
+	ofLogVerbose() << "Jitter: " << statistics.toString();
+	return statistics;
+}
+
+vector<JitterStatistics> compareJitter(Camera& camera, const vector<ThreadPlacement>& placements, unsigned int frames) {
+	vector<JitterStatistics> results(placements.size());
+	for(unsigned int i = 0; i < placements.size(); i++) {
+		// a fresh thread per run, so one placement doesn't leak into the next
+		thread run([&, i]() {
+			camera.setPlacement(placements[i]);
+			results[i] = measureJitter(camera, frames);
+		});
+		run.join();
+	}
+	camera.clearPlacement();
+	return results;
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+ ofxLibdc::ThreadPlacement pins the thread that grabs and converts frames to
+ chosen cores, optionally with SCHED_FIFO priority, and keeps its buffers on
+ the NUMA node of those cores.
+
+	ofxLibdc::ThreadPlacement placement;
+	placement.cores.push_back(2);
+	placement.priority = 50;
+	camera.setPlacement(placement);
+	...
+	// from the capture thread
+	camera.grabVideo(curFrame);
+	ofLogNotice() << camera.getPlacementReport().toString();
+
+ Capture and conversion both run on whichever thread calls grabVideo(), so
+ the placement is applied to that thread on its first grab. Buffers are
+ placed by first touch: once the thread is pinned, the destination image and
+ the burst arena are reallocated from it, so the kernel puts their pages on
+ the local node. Real-time priority usually needs root or CAP_SYS_NICE; if
+ it's refused the report says so and capture carries on normally.
+
+ Affinity and NUMA placement are only available on Linux.
+
+ measureJitter() grabs frames and measures how late each one is delivered
+ compared to its DMA timestamp. compareJitter() runs it once per placement,
+ each on a fresh thread, to compare configurations.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+
+namespace ofxLibdc {
+
+class Camera;
+
+struct ThreadPlacement {
+	vector<int> cores; // empty leaves affinity alone
+	int priority; // SCHED_FIFO priority from 1 to 99, 0 leaves the scheduler alone
+	bool numaLocal; // allocate buffers on the node of the first core
+	ThreadPlacement() : priority(0), numaLocal(true) {}
+};
+
+struct PlacementReport {
+	vector<int> cores; // cores the thread is allowed to run on afterwards
+	int priority; // SCHED_FIFO priority that was applied, 0 if none
+	int numaNode; // node the buffers were placed on, -1 if they weren't
+	bool applied; // true if everything that was asked for was applied
+	PlacementReport() : priority(0), numaNode(-1), applied(false) {}
+	string toString() const;
+};
+
+// applies the placement to the calling thread and reads back what stuck
+PlacementReport applyPlacement(const ThreadPlacement& placement);
+// NUMA node of a core, -1 if unknown
+int getNumaNode(int core);
+
+struct JitterStatistics {
+	unsigned int frames, dropped;
+	float meanInterval, intervalDeviation; // seconds between frames
+	float meanLatency, latencyDeviation; // seconds from DMA completion to delivery
+	float maxLatency, percentile99Latency;
+	PlacementReport placement;
+	JitterStatistics() : frames(0), dropped(0), meanInterval(0), intervalDeviation(0),
+	meanLatency(0), latencyDeviation(0), maxLatency(0), percentile99Latency(0) {}
+	string toString() const;
+};
+
+JitterStatistics measureJitter(Camera& camera, unsigned int frames = 300);
+vector<JitterStatistics> compareJitter(Camera& camera, const vector<ThreadPlacement>& placements, unsigned int frames = 300);
+
+}
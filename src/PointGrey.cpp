@@ -1,44 +1,117 @@
 #include "PointGrey.h"
+#include "Compression.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace ofxLibdc {
 
 #define readBits(x, pos, len) ((x >> (pos - len)) & ((1 << len) - 1))
 
+PointGrey::PointGrey() :
+frameInfo(0),
+frameInfoKnown(false),
+frameCount(0),
+positionLatency(0),
+nextRegion(0),
+currentPhase(0) {
+}
+
+void PointGrey::setupAlternatingStrobe() {
+	vector<StrobePhase> pattern;
+	pattern.push_back(StrobePhase(1 << 0));
+	pattern.push_back(StrobePhase(1 << 1));
+	setupStrobePattern(pattern);
+}
+
+// strobe delay and duration are counted in ticks of a 1.024 MHz clock
+static unsigned int getStrobeTicks(float seconds) {
+	return (unsigned int) ofClamp(seconds * 1.024e6, 0, 0xfff);
+}
+
 /*
- This code sets GPIO 0 and 1 to output alternating pulses.
+ This code sets up a strobe pattern on the GPIO pins.
  Information describing these registers can be found in that following documents:
  http://www.ptgrey.com/support/downloads/documents/TAN2005003_Output_variable_pattern_strobe_pulse.pdf
  http://www.ptgrey.com/support/downloads/documents/TAN2005002_Output_strobe_signal_pulse.pdf
  */
-void PointGrey::setupAlternatingStrobe() {	
+void PointGrey::setupStrobePattern(const vector<StrobePhase>& pattern, bool activeHigh) {
+	if(pattern.empty() || pattern.size() > PTGREY_STROBE_MAX_PHASES) {
+		ofLogError() << "Strobe patterns need between 1 and " << PTGREY_STROBE_MAX_PHASES << " phases.";
+		return;
+	}
 	if(camera) {
-		// put GPIO 0 and 1 in dcam output mode
-		dc1394_set_control_register(camera, PTGREY_GPIO_CTRL_PIN_0, 0x80080000);
-		dc1394_set_control_register(camera, PTGREY_GPIO_CTRL_PIN_1, 0x80080000);
-		
-		// put GPIO 0 and 1 in output mode
-		dc1394_set_control_register(camera, PTGREY_PIO_DIRECTION, 0xc0000000);
+		unsigned int direction = 0;
+		for(int pin = 0; pin < PTGREY_STROBE_PINS; pin++) {
+			// each pin only has one delay and duration, taken from the first phase that uses it
+			const StrobePhase* timing = NULL;
+			// one bit per phase starting from the top, a set bit fires the pin
+			unsigned int mask = 0xffff;
+			for(unsigned int i = 0; i < pattern.size(); i++) {
+				const StrobePhase& phase = pattern[i];
+				if(phase.pins & (1 << pin)) {
+					if(timing == NULL) {
+						timing = &phase;
+					} else if(phase.delay != timing->delay || phase.duration != timing->duration) {
+						ofLogWarning() << "Phases using GPIO " << pin << " need different timing, using the timing of the first.";
+					}
+				} else {
+					mask &= ~(1 << (15 - i));
+				}
+			}
+			if(timing == NULL) {
+				// a pin left over from a previous pattern would keep firing
+				dc1394_set_control_register(camera, PTGREY_GPIO_STRPAT_MASK_PIN(pin), 0x80000000);
+				dc1394_set_control_register(camera, PTGREY_STROBE_CNT(pin), 0x80000000);
+				continue;
+			}
+			direction |= 1 << (31 - pin);
+			
+			// put the pin in dcam output mode
+			dc1394_set_control_register(camera, PTGREY_GPIO_CTRL_PIN(pin), 0x80080000);
+			
+			// 0x82000000 means LOW polarity (short to ground while capturing)
+			// 0x83000000 means HIGH polarity (short to ground, unless capturing)
+			// followed by 12 bits of delay and 12 bits of duration, where a
+			// duration of 0 means the integration (shutter) time
+			unsigned int strobe = activeHigh ? 0x83000000 : 0x82000000;
+			strobe |= getStrobeTicks(timing->delay) << 12;
+			strobe |= getStrobeTicks(timing->duration);
+			dc1394_set_control_register(camera, PTGREY_STROBE_CNT(pin), strobe);
+			
+			dc1394_set_control_register(camera, PTGREY_GPIO_STRPAT_MASK_PIN(pin), 0x80000000 | mask);
+		}
 		
-		// set GPIO 0 and 1 delay to 0, and duration to the integration (shutter) time
-		// 0x82000000 means LOW polarity (short to ground while capturing)
-		// 0x83000000 means HIGH polarity (short to ground, unless capturing)
-		dc1394_set_control_register(camera, PTGREY_STROBE_0_CNT, 0x82000000);
-		dc1394_set_control_register(camera, PTGREY_STROBE_1_CNT, 0x82000000);
+		// put the used pins in output mode
+		dc1394_set_control_register(camera, PTGREY_PIO_DIRECTION, direction);
 		
-		// set strobe to a period of 2 frames
-		dc1394_set_control_register(camera, PTGREY_GPIO_STRPAT_CTRL, 0x80000200);
-		
-		// set GPIO 0 and 1 patterns to (1,0) and (0,1) respectively
-		dc1394_set_control_register(camera, PTGREY_GPIO_STRPAT_MASK_PIN_0, 0x8000bfff);
-		dc1394_set_control_register(camera, PTGREY_GPIO_STRPAT_MASK_PIN_1, 0x80007fff);
+		// set the strobe period in frames
+		dc1394_set_control_register(camera, PTGREY_GPIO_STRPAT_CTRL, 0x80000000 | ((pattern.size() & 0xf) << 8));
 		
 		setEmbeddedInfo(PTGREY_EMBED_STROBE_PATTERN);
 	}
+	phases.resize(pattern.size());
+	for(unsigned int i = 0; i < phases.size(); i++) {
+		phases[i].clear();
+	}
+	currentPhase = 0;
+}
+
+void PointGrey::clearStrobePattern() {
+	if(camera) {
+		dc1394_set_control_register(camera, PTGREY_GPIO_STRPAT_CTRL, 0x80000000);
+		setEmbeddedInfo(PTGREY_EMBED_STROBE_PATTERN, false);
+	}
+	phases.clear();
+	phaseOperations.clear();
 }
 
 void PointGrey::clearEmbeddedInfo() {
 	if(camera) {
 		dc1394_set_control_register(camera, PTGREY_FRAME_INFO, 0x80000000);
+		frameInfo = 0x80000000;
+		frameInfoKnown = true;
 	}
 }
 
@@ -51,6 +124,8 @@ void PointGrey::setEmbeddedInfo(int embeddedInfo, bool enable) {
 		else
 			reg &= ~(1 << embeddedInfo);
 		dc1394_set_control_register(camera, PTGREY_FRAME_INFO, reg);
+		frameInfo = reg;
+		frameInfoKnown = true;
 	}
 }
 
@@ -66,8 +141,11 @@ void PointGrey::setMaxFramerate() {
 
 unsigned int PointGrey::getEmbeddedInfoOffset(int embeddedInfo) const {
 	if(camera) {
-		unsigned int reg;
-		dc1394_get_control_register(camera, PTGREY_FRAME_INFO, &reg);
+		if(!frameInfoKnown) {
+			dc1394_get_control_register(camera, PTGREY_FRAME_INFO, &frameInfo);
+			frameInfoKnown = true;
+		}
+		unsigned int reg = frameInfo;
 		int total = 0;
 		for(int i = 0; i < embeddedInfo; i++)
 			if(reg & (1 << i))
@@ -106,4 +184,351 @@ unsigned int PointGrey::getEmbeddedStrobeCounter(unsigned char* pixels) const {
 	}
 }
 
+void PointGrey::queuePosition(unsigned int left, unsigned int top) {
+	enableEmbeddedPosition();
+	lock_guard<mutex> guard(positionLock);
+	QueuedPosition position = {left, top, 0};
+	queuedPositions.push_back(position);
+}
+
+void PointGrey::clearQueuedPositions() {
+	lock_guard<mutex> guard(positionLock);
+	queuedPositions.clear();
+}
+
+unsigned int PointGrey::getQueuedPositions() const {
+	lock_guard<mutex> guard(positionLock);
+	return queuedPositions.size();
+}
+
+float PointGrey::getPositionLatency() const {
+	lock_guard<mutex> guard(positionLock);
+	return positionLatency;
+}
+
+void PointGrey::readMetadata(dc1394video_frame_t* frame) {
+	frameCount++;
+	// the embedded timestamp is the cycle time when exposure started
+	if(useClockModel && (frameInfo & (1 << PTGREY_EMBED_TIMESTAMP)) && clockModel.isValid()) {
+		unsigned int value = getEmbeddedInfo(frame->image, PTGREY_EMBED_TIMESTAMP);
+		unsigned char* pv = (unsigned char*) &value;
+		uint32_t cycleTime = ((uint32_t) pv[0] << 24) | ((uint32_t) pv[1] << 16) | ((uint32_t) pv[2] << 8) | pv[3];
+		metadata.exposureStart = clockModel.toSteady(cycleTime);
+		metadata.exposureStartEmbedded = true;
+	}
+	if(!(frameInfo & (1 << PTGREY_EMBED_ROI))) {
+		return;
+	}
+	unsigned short embeddedLeft, embeddedTop;
+	getEmbeddedPosition(frame->image, &embeddedLeft, &embeddedTop);
+	metadata.left = embeddedLeft;
+	metadata.top = embeddedTop;
+	metadata.positionVerified = true;
+	
+	// the first applied position that matches this frame has taken effect,
+	// any before it were overwritten before a frame was captured with them
+	lock_guard<mutex> guard(positionLock);
+	for(unsigned int i = 0; i < appliedPositions.size(); i++) {
+		const QueuedPosition& applied = appliedPositions[i];
+		if(applied.left == embeddedLeft && applied.top == embeddedTop) {
+			float latency = frameCount - applied.frame;
+			positionLatency = positionLatency == 0 ? latency : ofLerp(positionLatency, latency, .1);
+			appliedPositions.erase(appliedPositions.begin(), appliedPositions.begin() + i + 1);
+			break;
+		}
+	}
+}
+
+void PointGrey::afterFrame() {
+	if(!regions.empty()) {
+		Region& region = regions[nextRegion];
+		applyPosition(region.requestedLeft, region.requestedTop);
+		// the camera reports the quantized position, so match against that
+		region.left = left;
+		region.top = top;
+		nextRegion = (nextRegion + 1) % regions.size();
+		return;
+	}
+	QueuedPosition position;
+	{
+		lock_guard<mutex> guard(positionLock);
+		if(queuedPositions.empty())
+			return;
+		position = queuedPositions.front();
+		queuedPositions.pop_front();
+	}
+	applyPosition(position.left, position.top);
+}
+
+void PointGrey::applyPosition(unsigned int left, unsigned int top) {
+	setPosition(left, top);
+	lock_guard<mutex> guard(positionLock);
+	QueuedPosition applied = {this->left, this->top, frameCount};
+	appliedPositions.push_back(applied);
+	// positions that never show up shouldn't pile up
+	if(appliedPositions.size() > 64)
+		appliedPositions.pop_front();
+}
+
+void PointGrey::enableEmbeddedPosition() {
+	if(camera) {
+		if(!frameInfoKnown) {
+			dc1394_get_control_register(camera, PTGREY_FRAME_INFO, &frameInfo);
+			frameInfoKnown = true;
+		}
+		if(!(frameInfo & (1 << PTGREY_EMBED_ROI)))
+			setEmbeddedInfo(PTGREY_EMBED_ROI);
+	}
+}
+
+void PointGrey::SubStream::clear() {
+	timestamp = 0;
+	frames = 0;
+	frameRate = 0;
+	frameNew = false;
+}
+
+void PointGrey::SubStream::add(uint64_t timestamp) {
+	if(this->timestamp > 0 && timestamp > this->timestamp) {
+		float instant = 1e6 / (timestamp - this->timestamp);
+		frameRate = frameRate == 0 ? instant : ofLerp(frameRate, instant, .1);
+	}
+	this->timestamp = timestamp;
+	frames++;
+	frameNew = true;
+}
+
+// dequeues every waiting frame and converts each one straight into the
+// sub-stream picked by route(). Frames without a sub-stream are dropped.
+bool PointGrey::updateStreams(SubStream* (PointGrey::*route)(dc1394video_frame_t*)) {
+	setTransmit(true);
+	bool updated = false;
+	dc1394video_frame_t* frame;
+	while(true) {
+		dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &frame);
+		if(frame == NULL)
+			break;
+		if(recorder)
+			recorder->addFrame(frame, useBayer, bayerMode);
+		
+		SubStream* stream = (this->*route)(frame);
+		if(stream != NULL) {
+			if(stream->pixels.getWidth() != width || stream->pixels.getHeight() != height) {
+				stream->pixels.allocate(width, height, imageType);
+			}
+			convertFrame(frame, stream->pixels.getData());
+			processRows = false;
+			stream->add(frame->timestamp);
+			updated = true;
+		}
+		readMetadata(frame);
+		dc1394_capture_enqueue(camera, frame);
+		if(stream != NULL)
+			updateAutoExposure();
+		afterFrame();
+	}
+	return updated;
+}
+
+void PointGrey::setRegions(const vector<ofVec2f>& positions) {
+	enableEmbeddedPosition();
+	regions.resize(positions.size());
+	for(unsigned int i = 0; i < positions.size(); i++) {
+		Region& region = regions[i];
+		region.requestedLeft = positions[i].x;
+		region.requestedTop = positions[i].y;
+		// not known until the position has been written once
+		region.left = region.top = ~0u;
+		region.stream.clear();
+	}
+	nextRegion = 0;
+}
+
+void PointGrey::clearRegions() {
+	regions.clear();
+}
+
+unsigned int PointGrey::getRegionCount() const {
+	return regions.size();
+}
+
+bool PointGrey::updateRegions() {
+	if(!camera || regions.empty()) {
+		return false;
+	}
+	for(unsigned int i = 0; i < regions.size(); i++) {
+		regions[i].stream.frameNew = false;
+	}
+	return updateStreams(&PointGrey::routeRegion);
+}
+
+// route on the position embedded by the camera, so frames captured
+// before a write took effect still land in the right sub-stream
+PointGrey::SubStream* PointGrey::routeRegion(dc1394video_frame_t* frame) {
+	unsigned short embeddedLeft, embeddedTop;
+	getEmbeddedPosition(frame->image, &embeddedLeft, &embeddedTop);
+	for(unsigned int i = 0; i < regions.size(); i++) {
+		if(regions[i].left == embeddedLeft && regions[i].top == embeddedTop) {
+			return &regions[i].stream;
+		}
+	}
+	return NULL;
+}
+
+bool PointGrey::isRegionFrameNew(unsigned int region) const {
+	return regions[region].stream.frameNew;
+}
+
+const ofPixels& PointGrey::getRegionPixels(unsigned int region) const {
+	return regions[region].stream.pixels;
+}
+
+uint64_t PointGrey::getRegionTimestamp(unsigned int region) const {
+	return regions[region].stream.timestamp;
+}
+
+uint64_t PointGrey::getRegionFrames(unsigned int region) const {
+	return regions[region].stream.frames;
+}
+
+float PointGrey::getRegionFrameRate(unsigned int region) const {
+	return regions[region].stream.frameRate;
+}
+
+unsigned int PointGrey::getPhaseCount() const {
+	return phases.size();
+}
+
+bool PointGrey::updatePhases() {
+	if(!camera || phases.empty()) {
+		return false;
+	}
+	for(unsigned int i = 0; i < phases.size(); i++) {
+		phases[i].frameNew = false;
+	}
+	return updateStreams(&PointGrey::routePhase);
+}
+
+PointGrey::SubStream* PointGrey::routePhase(dc1394video_frame_t* frame) {
+	currentPhase = getEmbeddedStrobeCounter(frame->image) % phases.size();
+	for(unsigned int i = 0; i < phaseOperations.size(); i++) {
+		ofPixels& pixels = phaseOperations[i].pixels;
+		if(pixels.getWidth() != width || pixels.getHeight() != height) {
+			pixels.allocate(width, height, imageType);
+		}
+	}
+	processRows = !phaseOperations.empty();
+	return &phases[currentPhase];
+}
+
+bool PointGrey::isPhaseFrameNew(unsigned int phase) const {
+	return phases[phase].frameNew;
+}
+
+const ofPixels& PointGrey::getPhasePixels(unsigned int phase) const {
+	return phases[phase].pixels;
+}
+
+uint64_t PointGrey::getPhaseTimestamp(unsigned int phase) const {
+	return phases[phase].timestamp;
+}
+
+uint64_t PointGrey::getPhaseFrames(unsigned int phase) const {
+	return phases[phase].frames;
+}
+
+float PointGrey::getPhaseFrameRate(unsigned int phase) const {
+	return phases[phase].frameRate;
+}
+
+unsigned int PointGrey::addPhaseOperation(unsigned int a, unsigned int b, ptGreyPhaseOperation operation) {
+	PhaseOperation phaseOperation;
+	phaseOperation.a = a;
+	phaseOperation.b = b;
+	phaseOperation.operation = operation;
+	phaseOperations.push_back(phaseOperation);
+	return phaseOperations.size() - 1;
+}
+
+void PointGrey::clearPhaseOperations() {
+	phaseOperations.clear();
+}
+
+const ofPixels& PointGrey::getPhaseOperationPixels(unsigned int operation) const {
+	return phaseOperations[operation].pixels;
+}
+
+static void subtractRow(const unsigned char* a, const unsigned char* b, unsigned char* out, unsigned int n) {
+	unsigned int i = 0;
+#ifdef __SSE2__
+	for(; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+		_mm_storeu_si128((__m128i*) (out + i), _mm_subs_epu8(va, vb));
+	}
+#endif
+	for(; i < n; i++) {
+		out[i] = a[i] > b[i] ? a[i] - b[i] : 0;
+	}
+}
+
+static void divideRow(const unsigned char* a, const unsigned char* b, unsigned char* out, unsigned int n) {
+	unsigned int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(128);
+	const __m128 one = _mm_set1_ps(1);
+	for(; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+		__m128i a16[2] = {_mm_unpacklo_epi8(va, zero), _mm_unpackhi_epi8(va, zero)};
+		__m128i b16[2] = {_mm_unpacklo_epi8(vb, zero), _mm_unpackhi_epi8(vb, zero)};
+		__m128i result[2];
+		for(int j = 0; j < 2; j++) {
+			__m128 a0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(a16[j], zero));
+			__m128 a1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(a16[j], zero));
+			__m128 b0 = _mm_max_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(b16[j], zero)), one);
+			__m128 b1 = _mm_max_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(b16[j], zero)), one);
+			__m128i r0 = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(a0, scale), b0));
+			__m128i r1 = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(a1, scale), b1));
+			// at most 128 * 255, so this fits in 16 bits before saturating to 8
+			result[j] = _mm_packs_epi32(r0, r1);
+		}
+		_mm_storeu_si128((__m128i*) (out + i), _mm_packus_epi16(result[0], result[1]));
+	}
+#endif
+	for(; i < n; i++) {
+		out[i] = min(128u * a[i] / max((unsigned int) b[i], 1u), 255u);
+	}
+}
+
+// combines each converted row with the same row of the other phase's latest
+// frame, while the new row is still in cache
+void PointGrey::processRow(unsigned char* row, unsigned int y) {
+	unsigned int rowBytes = width * getChannels();
+	for(unsigned int i = 0; i < phaseOperations.size(); i++) {
+		PhaseOperation& operation = phaseOperations[i];
+		unsigned int other;
+		if(currentPhase == operation.a) {
+			other = operation.b;
+		} else if(currentPhase == operation.b) {
+			other = operation.a;
+		} else {
+			continue;
+		}
+		if(other >= phases.size() || phases[other].frames == 0 || phases[other].pixels.getWidth() != width) {
+			continue;
+		}
+		const unsigned char* otherRow = phases[other].pixels.getData() + y * rowBytes;
+		const unsigned char* a = currentPhase == operation.a ? row : otherRow;
+		const unsigned char* b = currentPhase == operation.a ? otherRow : row;
+		unsigned char* out = operation.pixels.getData() + y * rowBytes;
+		if(operation.operation == PTGREY_PHASE_DIFFERENCE) {
+			subtractRow(a, b, out, rowBytes);
+		} else {
+			divideRow(a, b, out, rowBytes);
+		}
+	}
+}
+
 }
\ No newline at end of file
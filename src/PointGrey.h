@@ -13,6 +13,53 @@
  setupAlternatingStrobe() is a useful strobe pattern that will output a
  pulse on GPIO 0 and 1 on alternating frames. The strobe counter for a
  given frame can be retrieved using getEmbeddedStrobCounter().
+ 
+ setupStrobePattern() generalizes this to up to 15 phases, each firing any
+ of the four GPIO pins. The camera only has one delay and duration per pin,
+ so phases that need different timing should use different pins. Call
+ updatePhases() instead of grabVideo() to split frames into one stream per
+ phase, and addPhaseOperation() to get difference or ratio images between
+ two phases, computed row by row while each frame is converted.
+ 
+	vector<ofxLibdc::StrobePhase> pattern;
+	pattern.push_back(ofxLibdc::StrobePhase(1 << 0)); // lit
+	pattern.push_back(ofxLibdc::StrobePhase(0)); // unlit
+	camera.setupStrobePattern(pattern);
+	camera.addPhaseOperation(0, 1, ofxLibdc::PTGREY_PHASE_DIFFERENCE);
+	...
+	if(camera.updatePhases()) {
+		const ofPixels& litMinusUnlit = camera.getPhaseOperationPixels(0);
+	}
+ 
+ queuePosition() schedules Format7 ROI positions, one per frame. Each is
+ written between frames, and every grabbed frame is tagged with the position
+ embedded by the camera, available from getFrameMetadata().
+ getPositionLatency() reports how many frames it takes for a queued
+ position to show up.
+ 
+ With setClockModel() on and setEmbeddedInfo(PTGREY_EMBED_TIMESTAMP), the
+ exposure start in getFrameMetadata() comes from the cycle time the camera
+ embedded when exposure began, rather than being estimated from the host.
+ 
+ setRegions() cycles the ROI through a list of positions, one per frame, to
+ track several small regions that are far apart at a much higher rate than
+ a single ROI covering all of them. Every region shares the current Format7
+ size. Call updateRegions() instead of grabVideo(); each frame is routed by
+ its embedded position into its own sub-stream, with its own pixels,
+ timestamp and framerate.
+ 
+	camera.setFormat7(true);
+	camera.setSize(64, 64);
+	camera.setup();
+	camera.setRegions(positions);
+	...
+	if(camera.updateRegions()) {
+		for(int i = 0; i < camera.getRegionCount(); i++) {
+			if(camera.isRegionFrameNew(i)) {
+				const ofPixels& pixels = camera.getRegionPixels(i);
+			}
+		}
+	}
  */
 
 #pragma once
@@ -33,6 +80,14 @@ namespace ofxLibdc {
 #define PTGREY_GPIO_CTRL_PIN_1 0x1120
 #define PTGREY_GPIO_STRPAT_MASK_PIN_0 0x1118
 #define PTGREY_GPIO_STRPAT_MASK_PIN_1 0x1128
+#define PTGREY_GPIO_CTRL_PIN(pin) (PTGREY_GPIO_CTRL_PIN_0 + 0x10 * (pin))
+#define PTGREY_GPIO_STRPAT_MASK_PIN(pin) (PTGREY_GPIO_STRPAT_MASK_PIN_0 + 0x10 * (pin))
+#define PTGREY_STROBE_CNT(pin) (PTGREY_STROBE_0_CNT + 4 * (pin))
+
+#define PTGREY_STROBE_PINS 4
+// the period is a 4-bit field of GPIO_STRPAT_CTRL, so a pattern repeats
+// after at most 15 frames even though the pin masks have 16 bits
+#define PTGREY_STROBE_MAX_PHASES 15
 
 enum ptGreyEmbed {
 	PTGREY_EMBED_TIMESTAMP = 0,
@@ -47,9 +102,43 @@ enum ptGreyEmbed {
 	PTGREY_EMBED_ROI
 };
 
+enum ptGreyPhaseOperation {
+	PTGREY_PHASE_DIFFERENCE, // a - b, clamped at 0
+	PTGREY_PHASE_RATIO // 128 * a / b, clamped at 255
+};
+
+// one frame of a strobe pattern. pins is a bit mask of the GPIO pins that
+// fire during this frame. delay and duration are in seconds, a duration of 0
+// lasts for the whole exposure.
+struct StrobePhase {
+	unsigned int pins;
+	float delay, duration;
+	StrobePhase(unsigned int pins = 0, float delay = 0, float duration = 0) :
+	pins(pins), delay(delay), duration(duration) {}
+};
+
 class PointGrey : public Grabber {
 public:
+	PointGrey();
+	
 	void setupAlternatingStrobe();
+	void setupStrobePattern(const vector<StrobePhase>& phases, bool activeHigh = false);
+	void clearStrobePattern();
+	
+	unsigned int getPhaseCount() const;
+	// grabs every waiting frame, returns true if any phase got a new frame
+	bool updatePhases();
+	bool isPhaseFrameNew(unsigned int phase) const;
+	const ofPixels& getPhasePixels(unsigned int phase) const;
+	uint64_t getPhaseTimestamp(unsigned int phase) const; // in microseconds
+	uint64_t getPhaseFrames(unsigned int phase) const;
+	float getPhaseFrameRate(unsigned int phase) const;
+	
+	// combines the latest frames of two phases while converting, returns an
+	// index for getPhaseOperationPixels()
+	unsigned int addPhaseOperation(unsigned int a, unsigned int b, ptGreyPhaseOperation operation = PTGREY_PHASE_DIFFERENCE);
+	void clearPhaseOperations();
+	const ofPixels& getPhaseOperationPixels(unsigned int operation) const;
 	
 	void clearEmbeddedInfo();
 	void setEmbeddedInfo(int embeddedInfo, bool enable = true);
@@ -59,8 +148,75 @@ public:
 	unsigned int getEmbeddedStrobeCounter(unsigned char* pixels) const;
 	
 	void setMaxFramerate();
+	
+	void queuePosition(unsigned int left, unsigned int top);
+	void clearQueuedPositions();
+	unsigned int getQueuedPositions() const;
+	float getPositionLatency() const; // in frames
+	
+	void setRegions(const vector<ofVec2f>& positions);
+	void clearRegions();
+	unsigned int getRegionCount() const;
+	// grabs every waiting frame, returns true if any sub-stream got a new frame
+	bool updateRegions();
+	bool isRegionFrameNew(unsigned int region) const;
+	const ofPixels& getRegionPixels(unsigned int region) const;
+	uint64_t getRegionTimestamp(unsigned int region) const; // in microseconds
+	uint64_t getRegionFrames(unsigned int region) const;
+	float getRegionFrameRate(unsigned int region) const;
+	
 protected:
 	unsigned int getEmbeddedInfoOffset(int embeddedInfo) const;
+	
+	// cached copy of PTGREY_FRAME_INFO, so reading embedded info doesn't
+	// need a register read for every frame
+	mutable unsigned int frameInfo;
+	mutable bool frameInfoKnown;
+	
+	struct QueuedPosition {
+		unsigned int left, top;
+		uint64_t frame;
+	};
+	mutable mutex positionLock;
+	deque<QueuedPosition> queuedPositions, appliedPositions;
+	uint64_t frameCount;
+	float positionLatency;
+	
+	void enableEmbeddedPosition();
+	void applyPosition(unsigned int left, unsigned int top);
+	
+	struct SubStream {
+		ofPixels pixels;
+		uint64_t timestamp, frames;
+		float frameRate;
+		bool frameNew;
+		void clear();
+		void add(uint64_t timestamp);
+	};
+	bool updateStreams(SubStream* (PointGrey::*route)(dc1394video_frame_t*));
+	
+	struct Region {
+		unsigned int requestedLeft, requestedTop;
+		unsigned int left, top;
+		SubStream stream;
+	};
+	vector<Region> regions;
+	unsigned int nextRegion;
+	SubStream* routeRegion(dc1394video_frame_t* frame);
+	
+	struct PhaseOperation {
+		unsigned int a, b;
+		ptGreyPhaseOperation operation;
+		ofPixels pixels;
+	};
+	vector<SubStream> phases;
+	vector<PhaseOperation> phaseOperations;
+	unsigned int currentPhase;
+	SubStream* routePhase(dc1394video_frame_t* frame);
+	void processRow(unsigned char* row, unsigned int y);
+	
+	void readMetadata(dc1394video_frame_t* frame);
+	void afterFrame();
 };
 
 }
\ No newline at end of file
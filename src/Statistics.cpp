@@ -0,0 +1,149 @@
+#include "Statistics.h"
+
+namespace ofxLibdc {
+
+static void updateChannel(ChannelStatistics& statistics) {
+	uint64_t sum = 0;
+	statistics.count = 0;
+	statistics.min = 255;
+	statistics.max = 0;
+	for(unsigned int i = 0; i < 256; i++) {
+		unsigned int n = statistics.histogram[i];
+		if(n > 0) {
+			statistics.count += n;
+			sum += (uint64_t) n * i;
+			statistics.min = min(statistics.min, i);
+			statistics.max = i;
+		}
+	}
+	if(statistics.count == 0)
+		statistics.min = 0;
+	statistics.clippedLow = statistics.histogram[0];
+	statistics.clippedHigh = statistics.histogram[255];
+	statistics.mean = statistics.count > 0 ? (float) sum / statistics.count : 0;
+}
+
+// which channel each sample of an even and odd row belongs to
+static void getMosaicChannels(dc1394color_filter_t filter, unsigned int y, unsigned int* channels) {
+	static const unsigned int rggb[2][2] = {{0, 1}, {1, 2}};
+	static const unsigned int gbrg[2][2] = {{1, 2}, {0, 1}};
+	static const unsigned int grbg[2][2] = {{1, 0}, {2, 1}};
+	static const unsigned int bggr[2][2] = {{2, 1}, {1, 0}};
+	const unsigned int (*pattern)[2];
+	switch(filter) {
+		case DC1394_COLOR_FILTER_GBRG: pattern = gbrg; break;
+		case DC1394_COLOR_FILTER_GRBG: pattern = grbg; break;
+		case DC1394_COLOR_FILTER_BGGR: pattern = bggr; break;
+		default: pattern = rggb; break;
+	}
+	channels[0] = pattern[y % 2][0];
+	channels[1] = pattern[y % 2][1];
+}
+
+FrameStatistics::FrameStatistics() :
+width(0),
+height(0),
+channels(1),
+tileColumns(0),
+tileRows(0),
+timestamp(0) {
+	clear();
+}
+
+void FrameStatistics::setup(unsigned int width, unsigned int height, unsigned int channels,
+	unsigned int tileColumns, unsigned int tileRows) {
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	if(tileColumns == 0 || tileRows == 0) {
+		tileColumns = 0;
+		tileRows = 0;
+	}
+	this->tileColumns = tileColumns;
+	this->tileRows = tileRows;
+	tiles.resize(tileColumns * tileRows);
+	tileSums.resize(tileColumns * tileRows);
+	tileCounts.resize(tileColumns * tileRows);
+	clear();
+}
+
+void FrameStatistics::clear() {
+	memset(&luminance, 0, sizeof(luminance));
+	memset(channel, 0, sizeof(channel));
+	fill(tileSums.begin(), tileSums.end(), 0);
+	fill(tileCounts.begin(), tileCounts.end(), 0);
+	fill(tiles.begin(), tiles.end(), 0);
+	timestamp = 0;
+}
+
+void FrameStatistics::addRow(const unsigned char* row, unsigned int y) {
+	unsigned int* lumaHistogram = luminance.histogram;
+	unsigned int segments = max(tileColumns, 1u);
+	unsigned int tileRow = tileRows > 0 ? y * tileRows / height : 0;
+	for(unsigned int t = 0; t < segments; t++) {
+		unsigned int start = t * width / segments, end = (t + 1) * width / segments;
+		uint64_t sum = 0;
+		if(channels == 1) {
+			for(unsigned int x = start; x < end; x++) {
+				unsigned char v = row[x];
+				lumaHistogram[v]++;
+				sum += v;
+			}
+		} else {
+			unsigned int* red = channel[0].histogram;
+			unsigned int* green = channel[1].histogram;
+			unsigned int* blue = channel[2].histogram;
+			const unsigned char* pixel = row + start * channels;
+			for(unsigned int x = start; x < end; x++, pixel += channels) {
+				unsigned char r = pixel[0], g = pixel[1], b = pixel[2];
+				red[r]++;
+				green[g]++;
+				blue[b]++;
+				// integer Rec. 601 luma
+				unsigned int luma = (r * 77 + g * 150 + b * 29) >> 8;
+				lumaHistogram[luma]++;
+				sum += luma;
+			}
+		}
+		if(tileColumns > 0) {
+			tileSums[tileRow * tileColumns + t] += sum;
+			tileCounts[tileRow * tileColumns + t] += end - start;
+		}
+	}
+}
+
+void FrameStatistics::addMosaicRow(const unsigned char* row, unsigned int y, dc1394color_filter_t filter) {
+	unsigned int mosaic[2];
+	getMosaicChannels(filter, y, mosaic);
+	unsigned int* lumaHistogram = luminance.histogram;
+	unsigned int* even = channel[mosaic[0]].histogram;
+	unsigned int* odd = channel[mosaic[1]].histogram;
+	unsigned int segments = max(tileColumns, 1u);
+	unsigned int tileRow = tileRows > 0 ? y * tileRows / height : 0;
+	for(unsigned int t = 0; t < segments; t++) {
+		unsigned int start = t * width / segments, end = (t + 1) * width / segments;
+		uint64_t sum = 0;
+		for(unsigned int x = start; x < end; x++) {
+			unsigned char v = row[x];
+			(x % 2 ? odd : even)[v]++;
+			lumaHistogram[v]++;
+			sum += v;
+		}
+		if(tileColumns > 0) {
+			tileSums[tileRow * tileColumns + t] += sum;
+			tileCounts[tileRow * tileColumns + t] += end - start;
+		}
+	}
+}
+
+void FrameStatistics::update() {
+	updateChannel(luminance);
+	if(channels > 1) {
+		for(int i = 0; i < 3; i++)
+			updateChannel(channel[i]);
+	}
+	for(unsigned int i = 0; i < tiles.size(); i++)
+		tiles[i] = tileCounts[i] > 0 ? (float) tileSums[i] / tileCounts[i] : 0;
+}
+
+}
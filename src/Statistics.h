@@ -0,0 +1,60 @@
+/*
+ ofxLibdc::FrameStatistics describes the pixels of a frame: histograms, mean,
+ min/max and clipping for luminance and for each color channel, plus an
+ optional grid of per-tile mean luminance.
+
+	camera.setStatistics(true, 8, 6);
+	if(camera.grabVideo(curFrame)) {
+		const ofxLibdc::FrameStatistics* stats = camera.getFrameMetadata().statistics;
+		float mean = stats->luminance.mean;
+	}
+
+ The statistics are accumulated a row at a time inside the conversion pass,
+ while each row is still in cache, so they never cost another trip through
+ main memory. Bayer frames are measured on the mosaic, where every sample
+ belongs to exactly one channel.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "dc1394.h"
+#include <string.h>
+
+namespace ofxLibdc {
+
+struct ChannelStatistics {
+	unsigned int histogram[256];
+	unsigned int count;
+	unsigned int min, max;
+	unsigned int clippedLow, clippedHigh; // samples at 0 and at 255
+	float mean;
+};
+
+class FrameStatistics {
+public:
+	FrameStatistics();
+
+	// tileColumns and tileRows of 0 disable the tile grid
+	void setup(unsigned int width, unsigned int height, unsigned int channels,
+		unsigned int tileColumns = 0, unsigned int tileRows = 0);
+	void clear();
+	// interleaved gray or RGB pixels
+	void addRow(const unsigned char* row, unsigned int y);
+	// raw Bayer samples
+	void addMosaicRow(const unsigned char* row, unsigned int y, dc1394color_filter_t filter);
+	void update();
+
+	unsigned int width, height, channels;
+	ChannelStatistics luminance;
+	ChannelStatistics channel[3]; // only used for color frames
+	unsigned int tileColumns, tileRows;
+	vector<float> tiles; // mean luminance per tile, row major
+	uint64_t timestamp;
+
+protected:
+	vector<uint64_t> tileSums;
+	vector<unsigned int> tileCounts;
+};
+
+}
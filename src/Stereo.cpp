@@ -0,0 +1,466 @@
+#include "Stereo.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ofxLibdc {
+
+// more bands than threads, so a slow thread doesn't hold up the rest
+#define OFXLIBDC_STEREO_BANDS_PER_THREAD 2
+
+static unsigned int roundUp(unsigned int x, unsigned int multiple) {
+	return (x + multiple - 1) / multiple * multiple;
+}
+
+StereoMatcher::StereoMatcher() :
+width(0),
+height(0),
+maxDisparity(0),
+blockSize(0),
+rowStride(0),
+columnStride(0),
+uniqueness(.15),
+rectify(false),
+mapWidth(0),
+mapHeight(0),
+computeTime(0),
+leftPlane(NULL),
+rightPlane(NULL),
+planeWidth(0),
+planeHeight(0),
+job(NULL),
+generation(0),
+nextBand(0),
+completedBands(0),
+running(false) {
+}
+
+StereoMatcher::~StereoMatcher() {
+	{
+		lock_guard<mutex> guard(lock);
+		running = false;
+	}
+	jobAvailable.notify_all();
+	for(unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void StereoMatcher::setup(unsigned int width, unsigned int height, unsigned int maxDisparity, unsigned int blockSize, unsigned int threads) {
+	if(blockSize < 3 || blockSize > 15 || blockSize % 2 == 0) {
+		ofLogWarning() << "Stereo block size must be odd and from 3 to 15, not " << blockSize << ".";
+		blockSize = ofClamp(blockSize | 1, 3, 15);
+	}
+	// costs are summed in 16 bits, which holds 15 x 15 differences of 255
+	this->width = width;
+	this->height = height;
+	this->maxDisparity = max(maxDisparity, 1u);
+	this->blockSize = blockSize;
+	unsigned int radius = blockSize / 2;
+	rowStride = this->maxDisparity + roundUp(width, 16) + 16;
+	columnStride = roundUp(width, 16) + 2 * radius + 8;
+	leftRect.assign(rowStride * height, 0);
+	rightRect.assign(rowStride * height, 0);
+	disparity.allocate(width, height, OF_IMAGE_GRAYSCALE);
+	disparity.set(0, OFXLIBDC_DISPARITY_INVALID);
+	mapWidth = mapHeight = 0;
+
+	if(threads == 0) {
+		threads = max(1u, thread::hardware_concurrency());
+	}
+	unsigned int bandCount = min(threads * OFXLIBDC_STEREO_BANDS_PER_THREAD, max(height, 1u));
+	bands.resize(bandCount);
+	for(unsigned int i = 0; i < bandCount; i++) {
+		Band& band = bands[i];
+		band.start = i * height / bandCount;
+		band.end = (i + 1) * height / bandCount;
+		band.columnCosts.assign(this->maxDisparity * columnStride, 0);
+		band.costs.assign(this->maxDisparity * roundUp(width, 16), 0);
+		band.best.assign(roundUp(width, 16), 0);
+		band.bestDisparity.assign(roundUp(width, 16), 0);
+	}
+
+	// the calling thread takes part, so one fewer worker is needed
+	if(workers.size() != threads - 1) {
+		{
+			lock_guard<mutex> guard(lock);
+			running = false;
+		}
+		jobAvailable.notify_all();
+		for(unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+		workers.clear();
+		running = true;
+		for(unsigned int i = 0; i + 1 < threads; i++)
+			workers.push_back(thread(&StereoMatcher::workerThread, this));
+	}
+}
+
+void StereoMatcher::setUniqueness(float uniqueness) {
+	this->uniqueness = uniqueness;
+}
+
+void StereoMatcher::setRectification(const vector<ofVec2f>& left, const vector<ofVec2f>& right) {
+	if(left.size() != width * height || right.size() != width * height) {
+		ofLogError() << "Rectification maps need one position per pixel of the " << width << "x" << height << " disparity map.";
+		return;
+	}
+	leftSource = left;
+	rightSource = right;
+	rectify = true;
+	mapWidth = mapHeight = 0;
+}
+
+void StereoMatcher::clearRectification() {
+	leftSource.clear();
+	rightSource.clear();
+	rectify = false;
+	mapWidth = mapHeight = 0;
+}
+
+/*
+ Bayer green samples sit on a diagonal of each 2x2 quad: the main diagonal
+ for GRBG and GBRG, the other one for RGGB and BGGR. Averaging the two gives
+ one sample per quad, centered in it.
+ */
+static void extractGreen(const unsigned char* mosaic, unsigned int width, unsigned int height, dc1394color_filter_t filter, vector<unsigned char>& green) {
+	unsigned int greenWidth = width / 2, greenHeight = height / 2;
+	green.resize(greenWidth * greenHeight);
+	bool mainDiagonal = filter == DC1394_COLOR_FILTER_GRBG || filter == DC1394_COLOR_FILTER_GBRG;
+	for(unsigned int y = 0; y < greenHeight; y++) {
+		const unsigned char* top = mosaic + 2 * y * width;
+		const unsigned char* bottom = top + width;
+		unsigned char* out = &green[y * greenWidth];
+		if(mainDiagonal) {
+			for(unsigned int x = 0; x < greenWidth; x++)
+				out[x] = (top[2 * x] + bottom[2 * x + 1] + 1) >> 1;
+		} else {
+			for(unsigned int x = 0; x < greenWidth; x++)
+				out[x] = (top[2 * x + 1] + bottom[2 * x] + 1) >> 1;
+		}
+	}
+}
+
+void StereoMatcher::buildMap(const vector<ofVec2f>& source, vector<MapEntry>& map, unsigned int planeWidth, unsigned int planeHeight) {
+	map.resize(source.size());
+	for(unsigned int i = 0; i < source.size(); i++) {
+		float x = source[i].x, y = source[i].y;
+		MapEntry& entry = map[i];
+		if(x < 0 || y < 0 || x > planeWidth - 1 || y > planeHeight - 1) {
+			entry.index = -1;
+			entry.fx = entry.fy = 0;
+			continue;
+		}
+		// keep the 2x2 neighborhood inside the plane
+		unsigned int x0 = min((unsigned int) x, planeWidth - 2);
+		unsigned int y0 = min((unsigned int) y, planeHeight - 2);
+		entry.index = y0 * planeWidth + x0;
+		entry.fx = min((int) ((x - x0) * 256 + .5), 255);
+		entry.fy = min((int) ((y - y0) * 256 + .5), 255);
+	}
+}
+
+void StereoMatcher::buildMaps(unsigned int planeWidth, unsigned int planeHeight) {
+	if(planeWidth == mapWidth && planeHeight == mapHeight) {
+		return;
+	}
+	if(rectify) {
+		buildMap(leftSource, leftMap, planeWidth, planeHeight);
+		buildMap(rightSource, rightMap, planeWidth, planeHeight);
+	} else {
+		// a plain resize, sampling at pixel centers
+		vector<ofVec2f> resize(width * height);
+		float sx = (float) planeWidth / width, sy = (float) planeHeight / height;
+		for(unsigned int y = 0; y < height; y++) {
+			for(unsigned int x = 0; x < width; x++) {
+				resize[y * width + x].set(
+					ofClamp((x + .5) * sx - .5, 0, planeWidth - 1),
+					ofClamp((y + .5) * sy - .5, 0, planeHeight - 1));
+			}
+		}
+		buildMap(resize, leftMap, planeWidth, planeHeight);
+		rightMap = leftMap;
+	}
+	mapWidth = planeWidth;
+	mapHeight = planeHeight;
+}
+
+bool StereoMatcher::compute(const unsigned char* left, const unsigned char* right, unsigned int width, unsigned int height, StereoSource source, dc1394color_filter_t filter) {
+	if(bands.empty()) {
+		ofLogError() << "Call StereoMatcher::setup() before compute().";
+		return false;
+	}
+	uint64_t start = ofGetElapsedTimeMicros();
+	if(source == STEREO_SOURCE_BAYER_GREEN) {
+		extractGreen(left, width, height, filter, leftGreen);
+		extractGreen(right, width, height, filter, rightGreen);
+		leftPlane = &leftGreen[0];
+		rightPlane = &rightGreen[0];
+		planeWidth = width / 2;
+		planeHeight = height / 2;
+	} else {
+		leftPlane = left;
+		rightPlane = right;
+		planeWidth = width;
+		planeHeight = height;
+	}
+	if(planeWidth < 2 || planeHeight < 2) {
+		return false;
+	}
+	buildMaps(planeWidth, planeHeight);
+	run(&StereoMatcher::rectifyBand);
+	// matching reads rows on either side of each band, so it waits for all of them
+	run(&StereoMatcher::matchBand);
+	computeTime = (ofGetElapsedTimeMicros() - start) / 1e6;
+	return true;
+}
+
+static inline unsigned char sample(const unsigned char* plane, unsigned int planeWidth, int index, unsigned int fx, unsigned int fy) {
+	if(index < 0) {
+		return 0;
+	}
+	const unsigned char* p = plane + index;
+	unsigned int top = p[0] * (256 - fx) + p[1] * fx;
+	unsigned int bottom = p[planeWidth] * (256 - fx) + p[planeWidth + 1] * fx;
+	return (top * (256 - fy) + bottom * fy + (1 << 15)) >> 16;
+}
+
+void StereoMatcher::rectifyBand(unsigned int i) {
+	const Band& band = bands[i];
+	for(unsigned int y = band.start; y < band.end; y++) {
+		unsigned char* leftRow = &leftRect[y * rowStride];
+		unsigned char* rightRow = &rightRect[y * rowStride];
+		const MapEntry* leftEntries = &leftMap[y * width];
+		const MapEntry* rightEntries = &rightMap[y * width];
+		for(unsigned int x = 0; x < width; x++) {
+			const MapEntry& l = leftEntries[x];
+			const MapEntry& r = rightEntries[x];
+			leftRow[maxDisparity + x] = sample(leftPlane, planeWidth, l.index, l.fx, l.fy);
+			rightRow[maxDisparity + x] = sample(rightPlane, planeWidth, r.index, r.fx, r.fy);
+		}
+		// replicate the edges into the padding, so blocks near them stay defined
+		memset(leftRow, leftRow[maxDisparity], maxDisparity);
+		memset(rightRow, rightRow[maxDisparity], maxDisparity);
+		unsigned int end = maxDisparity + width;
+		memset(leftRow + end, leftRow[end - 1], rowStride - end);
+		memset(rightRow + end, rightRow[end - 1], rowStride - end);
+	}
+}
+
+/*
+ Every disparity keeps a running vertical sum of absolute differences per
+ column, so moving down a row adds the row entering the block and removes
+ the one leaving it. The 16 bit sums wrap, but the add and subtract cancel
+ exactly, so they never lose anything.
+ */
+void StereoMatcher::accumulateRow(Band& band, unsigned int y, bool add) {
+	unsigned int radius = blockSize / 2;
+	unsigned int paddedWidth = roundUp(width, 16);
+	const unsigned char* leftRow = &leftRect[y * rowStride] + maxDisparity;
+	for(unsigned int d = 0; d < maxDisparity; d++) {
+		const unsigned char* rightRow = &rightRect[y * rowStride] + maxDisparity - d;
+		uint16_t* columns = &band.columnCosts[d * columnStride + radius];
+		unsigned int x = 0;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		for(; x < paddedWidth; x += 16) {
+			__m128i l = _mm_loadu_si128((const __m128i*) (leftRow + x));
+			__m128i r = _mm_loadu_si128((const __m128i*) (rightRow + x));
+			__m128i difference = _mm_or_si128(_mm_subs_epu8(l, r), _mm_subs_epu8(r, l));
+			__m128i low = _mm_unpacklo_epi8(difference, zero);
+			__m128i high = _mm_unpackhi_epi8(difference, zero);
+			__m128i* out = (__m128i*) (columns + x);
+			__m128i sumLow = _mm_loadu_si128(out);
+			__m128i sumHigh = _mm_loadu_si128(out + 1);
+			if(add) {
+				sumLow = _mm_add_epi16(sumLow, low);
+				sumHigh = _mm_add_epi16(sumHigh, high);
+			} else {
+				sumLow = _mm_sub_epi16(sumLow, low);
+				sumHigh = _mm_sub_epi16(sumHigh, high);
+			}
+			_mm_storeu_si128(out, sumLow);
+			_mm_storeu_si128(out + 1, sumHigh);
+		}
+#endif
+		for(; x < paddedWidth; x++) {
+			uint16_t difference = abs((int) leftRow[x] - (int) rightRow[x]);
+			columns[x] += add ? difference : -difference;
+		}
+	}
+}
+
+void StereoMatcher::finishRow(Band& band, unsigned int y) {
+	unsigned int radius = blockSize / 2;
+	unsigned int costStride = roundUp(width, 16);
+	uint16_t* best = &band.best[0];
+	uint16_t* bestDisparity = &band.bestDisparity[0];
+	fill(band.best.begin(), band.best.end(), 0xffff);
+	fill(band.bestDisparity.begin(), band.bestDisparity.end(), 0);
+
+	// block sums and winner takes all, eight columns at a time
+	for(unsigned int d = 0; d < maxDisparity; d++) {
+		const uint16_t* columns = &band.columnCosts[d * columnStride + radius];
+		uint16_t* costs = &band.costs[d * costStride];
+		unsigned int x = 0;
+#ifdef __SSE2__
+		// SSE2 only compares signed 16 bit values, so flip the sign bit
+		const __m128i bias = _mm_set1_epi16((short) 0x8000);
+		const __m128i disparityVector = _mm_set1_epi16(d);
+		for(; x < costStride; x += 8) {
+			__m128i sum = _mm_setzero_si128();
+			for(int k = -(int) radius; k <= (int) radius; k++)
+				sum = _mm_add_epi16(sum, _mm_loadu_si128((const __m128i*) (columns + x + k)));
+			_mm_storeu_si128((__m128i*) (costs + x), sum);
+			__m128i previous = _mm_loadu_si128((const __m128i*) (best + x));
+			__m128i previousDisparity = _mm_loadu_si128((const __m128i*) (bestDisparity + x));
+			__m128i better = _mm_cmplt_epi16(_mm_xor_si128(sum, bias), _mm_xor_si128(previous, bias));
+			_mm_storeu_si128((__m128i*) (best + x), _mm_or_si128(_mm_and_si128(better, sum), _mm_andnot_si128(better, previous)));
+			_mm_storeu_si128((__m128i*) (bestDisparity + x), _mm_or_si128(_mm_and_si128(better, disparityVector), _mm_andnot_si128(better, previousDisparity)));
+		}
+#endif
+		for(; x < costStride; x++) {
+			uint16_t sum = 0;
+			for(int k = -(int) radius; k <= (int) radius; k++)
+				sum += columns[(int) x + k];
+			costs[x] = sum;
+			if(sum < best[x]) {
+				best[x] = sum;
+				bestDisparity[x] = d;
+			}
+		}
+	}
+
+	unsigned short* out = disparity.getData() + y * width;
+	for(unsigned int x = 0; x < width; x++) {
+		// near the left edge, large disparities look past the right image
+		unsigned int searched = min(maxDisparity, x + 1);
+		unsigned int match = bestDisparity[x];
+		unsigned int cost = best[x];
+		if(match >= searched) {
+			match = 0;
+			cost = band.costs[x];
+			for(unsigned int d = 1; d < searched; d++) {
+				if(band.costs[d * costStride + x] < cost) {
+					cost = band.costs[d * costStride + x];
+					match = d;
+				}
+			}
+		}
+		bool valid = true;
+		if(uniqueness > 0) {
+			float limit = cost * (1 + uniqueness);
+			for(unsigned int d = 0; d < searched && valid; d++) {
+				if((d + 1 < match || d > match + 1) && band.costs[d * costStride + x] <= limit)
+					valid = false;
+			}
+		}
+		if(!valid) {
+			out[x] = OFXLIBDC_DISPARITY_INVALID;
+			continue;
+		}
+		// fit a parabola through the neighboring costs for subpixel precision
+		int result = match * OFXLIBDC_DISPARITY_SCALE;
+		if(match > 0 && match + 1 < searched) {
+			int before = band.costs[(match - 1) * costStride + x];
+			int after = band.costs[(match + 1) * costStride + x];
+			int denominator = before + after - 2 * (int) cost;
+			if(denominator > 0)
+				result += lrintf(OFXLIBDC_DISPARITY_SCALE * (before - after) / (2.f * denominator));
+		}
+		out[x] = max(result, 0);
+	}
+}
+
+void StereoMatcher::matchBand(unsigned int i) {
+	Band& band = bands[i];
+	int radius = blockSize / 2;
+	int last = height - 1;
+	fill(band.columnCosts.begin(), band.columnCosts.end(), 0);
+	// rows past the top and bottom repeat the edge rows
+	for(int k = -radius; k <= radius; k++)
+		accumulateRow(band, ofClamp((int) band.start + k, 0, last), true);
+	for(unsigned int y = band.start; y < band.end; y++) {
+		if(y > band.start) {
+			accumulateRow(band, ofClamp((int) y + radius, 0, last), true);
+			accumulateRow(band, ofClamp((int) y - radius - 1, 0, last), false);
+		}
+		finishRow(band, y);
+	}
+}
+
+void StereoMatcher::run(void (StereoMatcher::*job)(unsigned int)) {
+	{
+		lock_guard<mutex> guard(lock);
+		this->job = job;
+		completedBands = 0;
+		nextBand = 0;
+		generation++;
+	}
+	jobAvailable.notify_all();
+	work();
+	unique_lock<mutex> guard(lock);
+	jobDone.wait(guard, [this] {
+		return completedBands == bands.size();
+	});
+}
+
+void StereoMatcher::work() {
+	unsigned int i;
+	while((i = nextBand++) < bands.size()) {
+		(this->*job)(i);
+		if(++completedBands == bands.size()) {
+			lock_guard<mutex> guard(lock);
+			jobDone.notify_all();
+		}
+	}
+}
+
+void StereoMatcher::workerThread() {
+	uint64_t seen = 0;
+	unique_lock<mutex> guard(lock);
+	while(true) {
+		jobAvailable.wait(guard, [this, &seen] {
+			return !running || generation != seen;
+		});
+		if(!running) {
+			return;
+		}
+		seen = generation;
+		guard.unlock();
+		work();
+		guard.lock();
+	}
+}
+
+const ofShortPixels& StereoMatcher::getDisparity() const {
+	return disparity;
+}
+
+void StereoMatcher::getDisparityPixels(ofPixels& pixels) const {
+	pixels.allocate(width, height, OF_IMAGE_GRAYSCALE);
+	const unsigned short* in = disparity.getData();
+	unsigned char* out = pixels.getData();
+	float scale = 255. / max((maxDisparity - 1) * OFXLIBDC_DISPARITY_SCALE, 1u);
+	for(unsigned int i = 0; i < width * height; i++) {
+		out[i] = in[i] == OFXLIBDC_DISPARITY_INVALID ? 0 : min(in[i] * scale, 255.f);
+	}
+}
+
+unsigned int StereoMatcher::getWidth() const {
+	return width;
+}
+
+unsigned int StereoMatcher::getHeight() const {
+	return height;
+}
+
+unsigned int StereoMatcher::getMaxDisparity() const {
+	return maxDisparity;
+}
+
+float StereoMatcher::getComputeTime() const {
+	return computeTime;
+}
+
+}
@@ -0,0 +1,125 @@
+/*
+ ofxLibdc::StereoMatcher computes a disparity map from a stereo camera with
+ multithreaded SSE2 block matching.
+
+	ofxLibdc::Camera camera(true);
+	ofxLibdc::StereoMatcher matcher;
+	matcher.setup(320, 240, 64, 9);
+	camera.setStereoMatcher(&matcher);
+	...
+	if(camera.grabDisparity()) {
+		const ofShortPixels& disparity = matcher.getDisparity();
+	}
+
+ grabDisparity() skips the color conversion entirely. Gray cameras are
+ matched on their pixels, and Bayer cameras on their green samples, which
+ gives a plane at half the resolution without demosaicing. grabVideo() with
+ two images still works, and also updates the matcher when one is set.
+
+ Both eyes are resampled to the size passed to setup(), which sets the
+ resolution of the disparity map. setRectification() replaces the plain
+ resize with per-pixel maps, for example from a stereo calibration. Each map
+ has one source position per output pixel, in the coordinates of the plane
+ being matched, so half resolution for Bayer cameras. The maps are converted
+ to fixed point once, and are applied with bilinear interpolation.
+
+ Disparities are stored in 1/16ths of a pixel, with OFXLIBDC_DISPARITY_INVALID
+ where the match is ambiguous or the block runs off the right image.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "dc1394.h"
+#include <string.h>
+#include <atomic>
+
+namespace ofxLibdc {
+
+#define OFXLIBDC_DISPARITY_SCALE 16
+#define OFXLIBDC_DISPARITY_INVALID 0xffff
+
+enum StereoSource {
+	STEREO_SOURCE_GRAY,
+	STEREO_SOURCE_BAYER_GREEN
+};
+
+class StereoMatcher {
+public:
+	StereoMatcher();
+	~StereoMatcher();
+
+	// blockSize is odd, from 3 to 15. threads = 0 uses one thread per core.
+	void setup(unsigned int width, unsigned int height, unsigned int maxDisparity = 64,
+		unsigned int blockSize = 9, unsigned int threads = 0);
+	// a match is rejected if another disparity comes within this fraction of
+	// its cost, 0 accepts every match
+	void setUniqueness(float uniqueness);
+	void setRectification(const vector<ofVec2f>& left, const vector<ofVec2f>& right);
+	void clearRectification();
+
+	// left and right are planes of width x height bytes
+	bool compute(const unsigned char* left, const unsigned char* right,
+		unsigned int width, unsigned int height,
+		StereoSource source = STEREO_SOURCE_GRAY,
+		dc1394color_filter_t filter = DC1394_COLOR_FILTER_RGGB);
+
+	const ofShortPixels& getDisparity() const;
+	// scaled to 0-255 for display, invalid pixels are 0
+	void getDisparityPixels(ofPixels& pixels) const;
+	unsigned int getWidth() const;
+	unsigned int getHeight() const;
+	unsigned int getMaxDisparity() const;
+	float getComputeTime() const; // seconds for the last compute()
+
+protected:
+	struct MapEntry {
+		int32_t index; // top left source sample, -1 outside the source
+		uint8_t fx, fy; // bilinear weights in 1/256ths
+	};
+	struct Band {
+		unsigned int start, end; // output rows
+		vector<uint16_t> columnCosts; // vertical sums, per disparity
+		vector<uint16_t> costs; // block costs of the current row, per disparity
+		vector<uint16_t> best, bestDisparity;
+	};
+
+	unsigned int width, height, maxDisparity, blockSize;
+	unsigned int rowStride, columnStride;
+	float uniqueness;
+	bool rectify;
+	vector<ofVec2f> leftSource, rightSource;
+	vector<MapEntry> leftMap, rightMap;
+	unsigned int mapWidth, mapHeight;
+	vector<unsigned char> leftGreen, rightGreen;
+	vector<unsigned char> leftRect, rightRect; // padded rows
+	vector<Band> bands;
+	ofShortPixels disparity;
+	float computeTime;
+
+	// the current job's input
+	const unsigned char *leftPlane, *rightPlane;
+	unsigned int planeWidth, planeHeight;
+
+	void buildMaps(unsigned int planeWidth, unsigned int planeHeight);
+	static void buildMap(const vector<ofVec2f>& source, vector<MapEntry>& map,
+		unsigned int planeWidth, unsigned int planeHeight);
+	void rectifyBand(unsigned int band);
+	void matchBand(unsigned int band);
+	void accumulateRow(Band& band, unsigned int y, bool add);
+	void finishRow(Band& band, unsigned int y);
+
+	// a small pool that runs one job over every band, the caller included
+	void run(void (StereoMatcher::*job)(unsigned int));
+	void work();
+	void workerThread();
+	vector<thread> workers;
+	mutex lock;
+	condition_variable jobAvailable, jobDone;
+	void (StereoMatcher::*job)(unsigned int);
+	uint64_t generation;
+	atomic<unsigned int> nextBand, completedBands;
+	bool running;
+};
+
+}
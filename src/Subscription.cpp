@@ -0,0 +1,76 @@
+#include "Subscription.h"
+
+namespace ofxLibdc {
+
+Subscription::Subscription(float frameRate, FrameCallback callback) :
+frameRate(frameRate),
+nextDue(0),
+frameNew(false),
+frames(0),
+callback(callback) {
+}
+
+void Subscription::setFrameRate(float frameRate) {
+	lock_guard<mutex> guard(lock);
+	this->frameRate = frameRate;
+	nextDue = 0;
+}
+
+float Subscription::getFrameRate() const {
+	lock_guard<mutex> guard(lock);
+	return frameRate;
+}
+
+bool Subscription::getFrame(FrameHandle& frame) {
+	lock_guard<mutex> guard(lock);
+	if(!frameNew) {
+		return false;
+	}
+	frame = latest;
+	frameNew = false;
+	return true;
+}
+
+uint64_t Subscription::getFrames() const {
+	lock_guard<mutex> guard(lock);
+	return frames;
+}
+
+/*
+ The schedule advances by whole intervals, so the average rate is exact even
+ when the requested rate doesn't divide the camera's. The tolerance lets a
+ frame that arrives slightly early still count, otherwise timestamp jitter
+ would push every other due frame to the next one.
+ */
+bool Subscription::isDue(uint64_t timestamp, uint64_t tolerance) {
+	lock_guard<mutex> guard(lock);
+	if(frameRate <= 0) {
+		return true;
+	}
+	if(timestamp + tolerance < nextDue) {
+		return false;
+	}
+	uint64_t interval = 1e6 / frameRate;
+	// start over after a gap instead of catching up with a burst
+	if(nextDue == 0 || timestamp > nextDue + interval) {
+		nextDue = timestamp;
+	}
+	nextDue += interval;
+	return true;
+}
+
+void Subscription::deliver(const FrameHandle& frame) {
+	FrameCallback callback;
+	{
+		lock_guard<mutex> guard(lock);
+		latest = frame;
+		frameNew = true;
+		frames++;
+		callback = this->callback;
+	}
+	if(callback) {
+		callback(frame);
+	}
+}
+
+}
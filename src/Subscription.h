@@ -0,0 +1,62 @@
+/*
+ ofxLibdc::Subscription shares one camera stream between several consumers,
+ each at its own rate.
+
+	shared_ptr<ofxLibdc::Subscription> analytics = camera.subscribe(15);
+	shared_ptr<ofxLibdc::Subscription> ui = camera.subscribe(5);
+	...
+	// capture thread
+	camera.updateSubscribers();
+	...
+	// any other thread
+	ofxLibdc::FrameHandle frame;
+	if(ui->getFrame(frame)) {
+		// frame->pixels
+	}
+
+ updateSubscribers() drains the DMA ring and decides, from each frame's
+ timestamp, which subscribers are due for it. A frame nobody is due for goes
+ straight back to the ring without being converted. Otherwise it is
+ converted once into a pooled buffer (see FramePool.h) and the same handle
+ is given to every subscriber that is due.
+
+ A subscriber can poll the newest frame with getFrame(), or pass a callback
+ to subscribe(), which is called on the capture thread. Releasing the last
+ shared_ptr to a Subscription unsubscribes it.
+ */
+
+#pragma once
+
+#include "ofMain.h"
+#include "FramePool.h"
+
+namespace ofxLibdc {
+
+typedef function<void(const FrameHandle&)> FrameCallback;
+
+class Subscription {
+public:
+	// a frameRate of 0 receives every frame
+	Subscription(float frameRate = 0, FrameCallback callback = FrameCallback());
+
+	void setFrameRate(float frameRate);
+	float getFrameRate() const;
+	// the newest frame that hasn't been returned yet
+	bool getFrame(FrameHandle& frame);
+	uint64_t getFrames() const;
+
+	// used by Camera, from the capture thread
+	bool isDue(uint64_t timestamp, uint64_t tolerance);
+	void deliver(const FrameHandle& frame);
+
+protected:
+	mutable mutex lock;
+	float frameRate;
+	uint64_t nextDue;
+	FrameHandle latest;
+	bool frameNew;
+	uint64_t frames;
+	FrameCallback callback;
+};
+
+}
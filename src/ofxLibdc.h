@@ -11,4 +11,10 @@
 #include "Grabber.h"
 
 // ofxLibdc::PointGrey extends Grabber and has some Point Grey-specific functionality
-#include "PointGrey.h"
\ No newline at end of file
+#include "PointGrey.h"
+
+// ofxLibdc::CompressedRecorder losslessly compresses raw frames on worker threads
+#include "Compression.h"
+
+// ofxLibdc::Pipeline runs processing stages on worker threads with bounded queues
+#include "Pipeline.h"
\ No newline at end of file